@@ -0,0 +1,109 @@
+#include "crc32c.h"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#endif
+
+#define CRC32C_POLY 0x82f63b78 /* reflected */
+
+static uint32_t table[8][256];
+static int table_ready = 0;
+
+static void make_table(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t c = i;
+
+        for (int k = 0; k < 8; ++k)
+            c = c & 1? (c >> 1) ^ CRC32C_POLY : c >> 1;
+
+        table[0][i] = c;
+    }
+
+    for (int k = 1; k < 8; ++k)
+        for (int i = 0; i < 256; ++i)
+            table[k][i] = (table[k-1][i] >> 8) ^ table[0][table[k-1][i] & 0xff];
+
+    table_ready = 1;
+}
+
+/*
+ * Eight bytes per step, each looked up in its own table. Assumes a
+ * little-endian host, like the packed buffers.
+ */
+static uint32_t crc32c_sw(uint32_t c, uint8_t const *p, size_t len)
+{
+    if (!table_ready)
+        make_table();
+
+    while (len >= 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= c;
+
+        c = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^ table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+            table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^ table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        c = (c >> 8) ^ table[0][(c ^ *p++) & 0xff];
+
+    return c;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t c, uint8_t const *p, size_t len)
+{
+    uint64_t c64 = c;
+
+    while (len >= 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c64 = _mm_crc32_u64(c64, w);
+        p += 8;
+        len -= 8;
+    }
+
+    c = (uint32_t)c64;
+
+    while (len--)
+        c = _mm_crc32_u8(c, *p++);
+
+    return c;
+}
+#endif
+
+int crc32c_hw(void)
+{
+#if defined(__SSE4_2__)
+    return 1;
+#elif defined(CRC32C_X86)
+    static int hw = -1;
+
+    if (hw < 0)
+        hw = !!__builtin_cpu_supports("sse4.2");
+
+    return hw;
+#else
+    return 0;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, void const *buf, size_t len)
+{
+#ifdef CRC32C_X86
+    if (crc32c_hw())
+        return ~crc32c_sse42(~crc, buf, len);
+#endif
+
+    return ~crc32c_sw(~crc, buf, len);
+}
@@ -0,0 +1,21 @@
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli polynomial, as in iSCSI and ext4) of buf[0, len),
+ * continuing from crc, which is 0 for a new checksum. Builds with SSE4.2
+ * enabled (e.g. -msse4.2 or -march=native) use the crc32 instruction
+ * directly. Other x86-64 builds check for it at run time, and anything else
+ * falls back to slice-by-8 tables.
+ */
+uint32_t crc32c(uint32_t crc, void const *buf, size_t len);
+
+/*
+ * 1 if crc32c runs on the crc32 instruction.
+ */
+int crc32c_hw(void);
+
+#endif
@@ -1,97 +1,146 @@
 #include "fasta_index.h"
 #include "mpiutil.h"
+#include "io_config.h"
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
 
-int fasta_index_read(fasta_index_t *faidx, char const *fname, string_store_t *names, commgrid_t const *grid)
+/*
+ * Next tab or space separated decimal field of a line, advancing *p.
+ */
+static size_t next_field(char const **p, char const *eol)
 {
-    int nprocs;       /* number of processes in comm                           */
-    int myrank;       /* my process id in comm                                 */
-    int *sendcounts;  /* MPI_Scatterv sendcounts for FAIDX records (root only) */
-    int *displs;      /* MPI_Scatterv displs for FAIDX records (root only)     */
-    int recvcount;    /* MPI_Scatterv recvcount for FAIDX records              */
+    size_t v = 0;
 
-    size_t pos;         /* byte position within faidx file buffer (root only)         */
-    size_t remain;      /* number of bytes remaining in faidx file buffer (root only) */
-    size_t avail_recs;  /* number of records available in memory (root only)          */
-    size_t linesize;    /* current line size (root only)                              */
+    while (*p < eol && (**p == '\t' || **p == ' '))
+        (*p)++;
 
-    char *buf;   /* faidx file buffer (root only)         */
-    char *ptr;   /* faidx file buffer pointer (root only) */
-    char *next;  /* address of next '\n' char (root only) */
+    for (; *p < eol && **p >= '0' && **p <= '9'; (*p)++)
+        v = 10*v + (size_t)(**p - '0');
+
+    return v;
+}
+
+/*
+ * Parse the FAIDX records of buf, a whole .fai file, appending them to
+ * *grecs (which holds *num_recs records in room for *avail_recs). buf is
+ * left unchanged so that the names can be taken from it afterwards.
+ */
+static void parse_records(char const *buf, size_t filesize, fasta_record_t **grecs, size_t *num_recs, size_t *avail_recs)
+{
+    char const *end = buf + filesize;
+    size_t numlines = 0;
+
+    for (char const *p = buf; p < end; ++numlines)
+    {
+        char const *nl = memchr(p, '\n', end - p);
+        p = nl? nl+1 : end;
+    }
+
+    if (*num_recs + numlines > *avail_recs)
+    {
+        *avail_recs = *num_recs + numlines;
+        *grecs = realloc(*grecs, *avail_recs * sizeof(fasta_record_t));
+    }
+
+    for (char const *p = buf; p < end; )
+    {
+        char const *nl = memchr(p, '\n', end - p);
+        char const *eol = nl? nl : end;
+        fasta_record_t *rec = &(*grecs)[(*num_recs)++];
 
+        while (p < eol && !isspace((unsigned char)*p)) /* name */
+            p++;
+
+        rec->len = next_field(&p, eol);
+        rec->pos = next_field(&p, eol);
+        rec->bases = next_field(&p, eol);
+
+        p = nl? nl+1 : end;
+    }
+}
+
+/*
+ * Root process slurps in an entire FAIDX file and parses its records. The
+ * names are then compacted in place and the buffer is handed to names.
+ */
+static void read_records(char const *fname, string_store_t *names, fasta_record_t **grecs, size_t *num_recs, size_t *avail_recs)
+{
     MPI_File fh;
     MPI_Offset filesize;
+    char *buf;
 
-    fasta_record_t *grecs, *myrecs, *rec;
-    size_t num_recs;
+    MPI_CHECK(MPI_File_open(MPI_COMM_SELF, fname, MPI_MODE_RDONLY, io_config_current().info, &fh));
 
-    nprocs = grid->dims * grid->dims;
-    myrank = grid->gridrank;
+    MPI_File_get_size(fh, &filesize);
 
-    if (myrank == 0)
-    {
-        /*
-         * Root process slurps in the entire FAIDX file.
-         */
-        MPI_CHECK(MPI_File_open(MPI_COMM_SELF, fname, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh));
+    buf = malloc(filesize);
 
-        MPI_File_get_size(fh, &filesize);
+    MPI_File_read(fh, buf, filesize, MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
 
-        buf = malloc(filesize);
+    parse_records(buf, filesize, grecs, num_recs, avail_recs);
 
-        MPI_File_read(fh, buf, filesize, MPI_CHAR, MPI_STATUS_IGNORE);
-        MPI_File_close(&fh);
+    if (names != NULL)
+        sstore_push_fields(names, buf, filesize, SSTORE_ADOPT);
+    else
+        free(buf);
+}
 
-        /*
-         * Parse each FAIDX record from the file buffer.
-         */
-        ptr = buf;
-        remain = filesize;
-        pos = num_recs = avail_recs = 0;
-        grecs = NULL;
+/*
+ * Scatter the records assigned by sendcounts (root only) to every process.
+ */
+static void scatter_records(fasta_index_t *faidx, fasta_record_t *grecs, int *sendcounts, int *displs, commgrid_t const *grid)
+{
+    int recvcount;    /* MPI_Scatterv recvcount for FAIDX records */
+    fasta_record_t *myrecs;
 
-        while (pos < filesize)
-        {
-            next = memchr(ptr, '\n', remain);
+    /*
+     * Root process tells each process how many FAIDX records it will be sent.
+     */
+    MPI_Scatter(sendcounts, 1, MPI_INT, &recvcount, 1, MPI_INT, 0, grid->grid_world);
 
-            if (next == NULL) /* TODO: this could be problematic if file does not have '\n' as its last character */
-                break;
+    /*
+     * Each process will receive its assigned portion of FAIDX records
+     * at the location pointed to by myrecs.
+     */
+    myrecs = malloc(recvcount * sizeof(fasta_record_t));
 
-            *next = (char)0; /* TODO: otherwise sscanf might be a problem (not actually positive but there is no downside, test later */
-            linesize = next - ptr;
-            assert(linesize <= remain);
+    MPI_Datatype fasta_index_mpi_t;
+    MPI_Type_contiguous(3, MPI_SIZE_T, &fasta_index_mpi_t);
+    MPI_Type_commit(&fasta_index_mpi_t);
 
-            if (num_recs + 1 > avail_recs)
-            {
-                avail_recs = up_size_t(num_recs + 1);
-                avail_recs = avail_recs > 256? avail_recs : 256;
-                grecs = realloc(grecs, avail_recs * sizeof(fasta_record_t));
-            }
+    MPI_Scatterv(grecs, sendcounts, displs, fasta_index_mpi_t, myrecs, recvcount, fasta_index_mpi_t, 0, grid->grid_world);
+    MPI_Type_free(&fasta_index_mpi_t);
 
-            rec = &grecs[num_recs++];
-            sscanf(ptr, "%*s %zu %zu %zu %*zu", &rec->len, &rec->pos, &rec->bases);
+    *faidx = (fasta_index_t){0};
+    faidx->records = myrecs;
+    faidx->num_records = recvcount;
+    faidx->grid = grid;
+}
 
-            if (names != NULL)
-            {
-                size_t namelen;
+int fasta_index_read(fasta_index_t *faidx, char const *fname, string_store_t *names, commgrid_t const *grid)
+{
+    int nprocs;       /* number of processes in comm                           */
+    int myrank;       /* my process id in comm                                 */
+    int *sendcounts;  /* MPI_Scatterv sendcounts for FAIDX records (root only) */
+    int *displs;      /* MPI_Scatterv displs for FAIDX records (root only)     */
 
-                for (namelen = 0; namelen < linesize; ++namelen)
-                    if (isspace(ptr[namelen]))
-                        break;
+    fasta_record_t *grecs;
+    size_t num_recs, avail_recs;
 
-                sstore_push(names, ptr, namelen);
-            }
+    nprocs = grid->dims * grid->dims;
+    myrank = grid->gridrank;
 
-            pos += linesize;
-            ptr = &buf[++pos];
-            remain = filesize - pos;
-        }
+    if (myrank == 0)
+    {
+        num_recs = avail_recs = 0;
+        grecs = NULL;
+
+        read_records(fname, names, &grecs, &num_recs, &avail_recs);
 
-        free(buf);
         grecs = realloc(grecs, num_recs * sizeof(fasta_record_t));
 
         sendcounts = malloc(nprocs * sizeof(int));
@@ -112,23 +161,77 @@ int fasta_index_read(fasta_index_t *faidx, char const *fname, string_store_t *na
         sendcounts[nprocs-1] = num_recs - (nprocs-1)*(num_recs/nprocs);
     }
 
-    /*
-     * Root process tells each process how many FAIDX records it will be sent.
-     */
-    MPI_Scatter(sendcounts, 1, MPI_INT, &recvcount, 1, MPI_INT, 0, grid->grid_world);
+    scatter_records(faidx, grecs, sendcounts, displs, grid);
 
-    /*
-     * Each process will receive its assigned portion of FAIDX records
-     * at the location pointed to by myrecs.
-     */
-    myrecs = malloc(recvcount * sizeof(fasta_record_t));
+    if (myrank == 0)
+    {
+        free(grecs);
+        free(sendcounts);
+        free(displs);
+    }
 
-    MPI_Datatype fasta_index_mpi_t;
-    MPI_Type_contiguous(3, MPI_SIZE_T, &fasta_index_mpi_t);
-    MPI_Type_commit(&fasta_index_mpi_t);
+    return 0;
+}
 
-    MPI_Scatterv(grecs, sendcounts, displs, fasta_index_mpi_t, myrecs, recvcount, fasta_index_mpi_t, 0, grid->grid_world);
-    MPI_Type_free(&fasta_index_mpi_t);
+/*
+ * Index a list of FASTA files as one: the records of fnames[0], fnames[1], ...
+ * (the .fai files) get consecutive global ids, and faidx->fileoffsets[f] is
+ * the global id of the first record of file f. Processes get contiguous runs
+ * of records holding about the same number of bases, so one large file is
+ * split over many processes while many small ones share a process.
+ * faidx->runs tells which file each local record comes from.
+ */
+int fasta_index_read_files(fasta_index_t *faidx, char const * const *fnames, int numfiles, string_store_t *names, commgrid_t const *grid)
+{
+    if (numfiles < 1)
+        return -1;
+
+    int nprocs = grid->dims * grid->dims;
+    int myrank = grid->gridrank;
+    int *sendcounts = NULL, *displs = NULL;
+    size_t *fileoffsets = malloc((numfiles + 1) * sizeof(size_t));
+
+    fasta_record_t *grecs = NULL;
+    size_t num_recs = 0, avail_recs = 0;
+
+    if (myrank == 0)
+    {
+        for (int f = 0; f < numfiles; ++f)
+        {
+            fileoffsets[f] = num_recs;
+            read_records(fnames[f], names, &grecs, &num_recs, &avail_recs);
+        }
+
+        fileoffsets[numfiles] = num_recs;
+
+        /*
+         * Record i goes to the process whose share of the total bases holds
+         * the middle of record i.
+         */
+        uint64_t totbases = 0, cumbases = 0;
+
+        for (size_t i = 0; i < num_recs; ++i)
+            totbases += grecs[i].len;
+
+        sendcounts = calloc(nprocs, sizeof(int));
+        displs = malloc(nprocs * sizeof(int));
+
+        for (size_t i = 0; i < num_recs; ++i)
+        {
+            uint64_t mid = cumbases + grecs[i].len / 2;
+            int owner = totbases? (int)((mid * nprocs) / totbases) : (int)((i * nprocs) / num_recs);
+
+            sendcounts[owner < nprocs? owner : nprocs-1]++;
+            cumbases += grecs[i].len;
+        }
+
+        displs[0] = 0;
+
+        for (int i = 0; i < nprocs-1; ++i)
+            displs[i+1] = displs[i] + sendcounts[i];
+    }
+
+    scatter_records(faidx, grecs, sendcounts, displs, grid);
 
     if (myrank == 0)
     {
@@ -137,9 +240,29 @@ int fasta_index_read(fasta_index_t *faidx, char const *fname, string_store_t *na
         free(displs);
     }
 
-    faidx->records = myrecs;
-    faidx->num_records = recvcount;
-    faidx->grid = grid;
+    MPI_Bcast(fileoffsets, numfiles + 1, MPI_SIZE_T, 0, grid->grid_world);
+
+    size_t first = 0;
+    MPI_Exscan(&faidx->num_records, &first, 1, MPI_SIZE_T, MPI_SUM, grid->grid_world);
+    if (!myrank) first = 0;
+
+    /*
+     * Split the local records into runs by file.
+     */
+    faidx->numfiles = numfiles;
+    faidx->fileoffsets = fileoffsets;
+    faidx->runs = malloc(numfiles * sizeof(fasta_run_t));
+
+    for (int f = 0; f < numfiles; ++f)
+    {
+        size_t lo = fileoffsets[f] > first? fileoffsets[f] : first;
+        size_t hi = fileoffsets[f+1] < first + faidx->num_records? fileoffsets[f+1] : first + faidx->num_records;
+
+        if (lo < hi)
+            faidx->runs[faidx->numruns++] = (fasta_run_t){f, lo - first};
+    }
+
+    faidx->runs = realloc(faidx->runs, faidx->numruns * sizeof(fasta_run_t));
 
     return 0;
 }
@@ -149,6 +272,8 @@ int fasta_index_free(fasta_index_t *faidx)
     if (!faidx) return -1;
 
     free(faidx->records);
+    free(faidx->fileoffsets);
+    free(faidx->runs);
     *faidx = (fasta_index_t){0};
     return 0;
 }
@@ -5,17 +5,36 @@
 #include "mstring.h"
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct { size_t len, pos, bases; } fasta_record_t;
 
+/*
+ * Run of local records from one FASTA file: records [first, next run's
+ * first) belong to file number file.
+ */
+typedef struct { int file; size_t first; } fasta_run_t;
+
 typedef struct
 {
     commgrid_t const *grid;
     fasta_record_t *records;
     size_t num_records;
+    int numfiles;        /* number of FASTA files, 0 for a single-file index */
+    size_t *fileoffsets; /* global id of the first record of each file (numfiles+1 entries) */
+    fasta_run_t *runs;   /* local records by file */
+    int numruns;
 } fasta_index_t;
 
 int fasta_index_read(fasta_index_t *faidx, char const *fname, string_store_t *names, commgrid_t const *grid);
+int fasta_index_read_files(fasta_index_t *faidx, char const * const *fnames, int numfiles, string_store_t *names, commgrid_t const *grid);
 int fasta_index_free(fasta_index_t *faidx);
 void fasta_index_log(const fasta_index_t faidx, char const *fname_prefix);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
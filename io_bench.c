@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "mpiutil.h"
+#include "fasta_index.h"
+#include "seq_store.h"
+#include "io_config.h"
+
+/*
+ * Times seq_store_read with collective and independent reads, each with
+ * unaligned and aligned file domains, under the hints configured through
+ * SEQCOMM_IO_CONFIG and the environment (see io_config.h). The hints the
+ * MPI-IO layer actually applied are printed, and every run is checked to
+ * build the same store. Finally the collective aligned read is repeated with
+ * per-sequence checksums (see seq_store_set_crc) to measure their overhead.
+ * Last, repeated shares of the store through seq_store_share are timed
+ * against a persistent share plan (see seq_share_plan_init), changing the
+ * packed bytes between repeats, and every plan result is checked against
+ * seq_store_share.
+ *
+ * usage: io_bench <fasta> [align] [repeats]
+ */
+
+static char const *reported_hints[] = {"cb_nodes", "cb_buffer_size", "romio_cb_read", "striping_unit"};
+
+static void print_hints(char const *fname, MPI_Comm comm)
+{
+    MPI_File fh;
+    MPI_Info info;
+    int myrank;
+
+    mpi_info(comm, &myrank, NULL);
+
+    MPI_CHECK(MPI_File_open(comm, fname, MPI_MODE_RDONLY, io_config_current().info, &fh));
+    MPI_File_get_info(fh, &info);
+
+    if (!myrank)
+    {
+        printf("effective hints:");
+
+        for (size_t i = 0; i < sizeof(reported_hints) / sizeof(reported_hints[0]); ++i)
+        {
+            char val[MPI_MAX_INFO_VAL+1];
+            int flag;
+
+            MPI_Info_get(info, reported_hints[i], MPI_MAX_INFO_VAL, val, &flag);
+            printf(" %s=%s", reported_hints[i], flag? val : "(unset)");
+        }
+
+        printf("\n");
+        fflush(stdout);
+    }
+
+    MPI_Info_free(&info);
+    MPI_File_close(&fh);
+}
+
+static uint64_t store_digest(const seq_store_t store)
+{
+    uint64_t h = store.numseqs ^ (store.totbases << 20);
+
+    for (size_t i = 0; i < store.numbytes; ++i)
+        h = (h ^ store.buf[i]) * 0x100000001b3ULL;
+
+    for (size_t i = 0; i < store.numseqs; ++i)
+        h = (h ^ seq_store_gid(store, i)) * 0x100000001b3ULL;
+
+    return h;
+}
+
+static double bench_read(char const *fname, const fasta_index_t faidx, io_config_t cfg, int repeats, int crc, uint64_t *digest)
+{
+    commgrid_t const *grid = faidx.grid;
+    double t, mint = 1e30, maxt;
+    uint64_t h = 0;
+    int ok = 1, allok;
+
+    io_config_set(&cfg);
+    seq_store_set_crc(crc);
+
+    for (int r = 0; r < repeats; ++r)
+    {
+        seq_store_t store;
+
+        MPI_Barrier(grid->grid_world);
+        t = -MPI_Wtime();
+        seq_store_read(&store, fname, faidx);
+        t += MPI_Wtime();
+
+        MPI_Allreduce(&t, &maxt, 1, MPI_DOUBLE, MPI_MAX, grid->grid_world);
+        mint = maxt < mint? maxt : mint;
+
+        h = store_digest(store);
+        seq_store_free(&store);
+    }
+
+    if (!*digest) *digest = h;
+    ok = (h == *digest);
+
+    MPI_Reduce(&ok, &allok, 1, MPI_INT, MPI_LAND, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        printf("%-11s align %8lu%s: %.4fs [%s]\n", cfg.independent? "independent" : "collective", cfg.align, crc? " crc32c" : "", mint, allok? "match" : "MISMATCH");
+        fflush(stdout);
+    }
+
+    seq_store_set_crc(0);
+    io_config_set(NULL);
+
+    return mint;
+}
+
+static int same_store(const seq_store_t *a, const seq_store_t *b)
+{
+    if (a->numseqs != b->numseqs || a->numbytes != b->numbytes || a->totbases != b->totbases)
+        return 0;
+
+    for (size_t i = 0; i < a->numseqs; ++i)
+    {
+        if (seq_store_length(*a, i) != seq_store_length(*b, i) || seq_store_offset(*a, i) != seq_store_offset(*b, i))
+            return 0;
+
+        if (seq_store_gid(*a, i) != seq_store_gid(*b, i) || seq_store_lid(*a, seq_store_gid(*b, i)) != i)
+            return 0;
+    }
+
+    return !memcmp(a->buf, b->buf, a->numbytes);
+}
+
+static void bench_plan(char const *fname, const fasta_index_t faidx, int repeats)
+{
+    commgrid_t const *grid = faidx.grid;
+    double t, sharet = 0, plant = 0, initt;
+    int ok = 1, allok;
+
+    seq_store_t store;
+    seq_store_read(&store, fname, faidx);
+
+    seq_share_plan_t plan;
+
+    MPI_Barrier(grid->grid_world);
+    initt = -MPI_Wtime();
+    seq_share_plan_init(&plan, store, grid);
+    initt += MPI_Wtime();
+
+    for (int r = 0; r < repeats; ++r)
+    {
+        seq_store_t row_store, col_store;
+        seq_store_t const *plan_row, *plan_col;
+
+        /* new content in the same shape, as after masking or re-filtering bases */
+        for (size_t i = 0; i < store.numbytes; ++i)
+            store.buf[i] ^= (uint8_t)(0x5b + r);
+
+        MPI_Barrier(grid->grid_world);
+        t = -MPI_Wtime();
+        seq_store_share(store, &row_store, &col_store, grid);
+        t += MPI_Wtime();
+        sharet += t;
+
+        MPI_Barrier(grid->grid_world);
+        t = -MPI_Wtime();
+        ok &= !seq_share_plan_start(&plan, store);
+        seq_share_plan_wait(&plan, &plan_row, &plan_col);
+        t += MPI_Wtime();
+        plant += t;
+
+        ok &= same_store(plan_row, &row_store) && same_store(plan_col, &col_store);
+
+        seq_store_free(&row_store);
+        seq_store_free(&col_store);
+    }
+
+    double times[3] = {sharet / repeats, plant / repeats, initt}, maxtimes[3];
+
+    MPI_Reduce(times, maxtimes, 3, MPI_DOUBLE, MPI_MAX, 0, grid->grid_world);
+    MPI_Reduce(&ok, &allok, 1, MPI_INT, MPI_LAND, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        printf("share %.4fs, plan start/wait %.4fs (init %.4fs, MPI-%d) [%s]\n", maxtimes[0], maxtimes[1], maxtimes[2], MPI_VERSION, allok? "match" : "MISMATCH");
+        fflush(stdout);
+    }
+
+    seq_share_plan_free(&plan);
+    seq_store_free(&store);
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <fasta> [align] [repeats]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    const char *fasta_fname = argv[1];
+    size_t align = argc > 2? strtoull(argv[2], NULL, 10) : 0;
+    int repeats = argc > 3? atoi(argv[3]) : 3;
+
+    char *faidx_fname = malloc(strlen(fasta_fname) + 5);
+    sprintf(faidx_fname, "%s.fai", fasta_fname);
+
+    commgrid_t grid;
+    assert(commgrid_init(&grid) != -1);
+
+    io_config_t cfg;
+    io_config_init(&cfg, getenv("SEQCOMM_IO_CONFIG"), grid.grid_world);
+
+    align = align? align : cfg.align? cfg.align : 1 << 20;
+
+    if (!grid.gridrank) io_config_log(cfg, stdout);
+
+    io_config_set(&cfg);
+    print_hints(fasta_fname, grid.grid_world);
+
+    fasta_index_t faidx;
+    fasta_index_read(&faidx, faidx_fname, NULL, &grid);
+
+    uint64_t digest = 0;
+
+    for (int independent = 0; independent < 2; ++independent)
+    {
+        bench_read(fasta_fname, faidx, (io_config_t){cfg.info, 0, independent}, repeats, 0, &digest);
+        bench_read(fasta_fname, faidx, (io_config_t){cfg.info, align, independent}, repeats, 0, &digest);
+    }
+
+    double plain = bench_read(fasta_fname, faidx, (io_config_t){cfg.info, align, 0}, repeats, 0, &digest);
+    double checked = bench_read(fasta_fname, faidx, (io_config_t){cfg.info, align, 0}, repeats, 1, &digest);
+
+    if (!grid.gridrank)
+        printf("crc32c load overhead: %.1f%%\n", plain > 0? 100 * (checked - plain) / plain : 0.0);
+
+    io_config_set(&cfg);
+    bench_plan(fasta_fname, faidx, repeats);
+    io_config_set(NULL);
+
+    fasta_index_free(&faidx);
+    io_config_free(&cfg);
+    commgrid_free(&grid);
+    free(faidx_fname);
+
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "io_config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+static io_config_t const *current = NULL;
+
+static char const *envkeys[][2] =
+{
+    {"cb_nodes", "SEQCOMM_CB_NODES"},
+    {"cb_buffer_size", "SEQCOMM_CB_BUFFER_SIZE"},
+    {"romio_cb_read", "SEQCOMM_ROMIO_CB_READ"},
+    {"striping_unit", "SEQCOMM_STRIPING_UNIT"},
+    {"align", "SEQCOMM_IO_ALIGN"},
+    {"independent", "SEQCOMM_IO_INDEPENDENT"},
+};
+
+static void config_set(io_config_t *cfg, char const *key, char const *val)
+{
+    if (!strcmp(key, "align"))
+        cfg->align = strtoull(val, NULL, 10);
+    else if (!strcmp(key, "independent"))
+        cfg->independent = atoi(val);
+    else
+    {
+        if (cfg->info == MPI_INFO_NULL)
+            MPI_Info_create(&cfg->info);
+
+        MPI_Info_set(cfg->info, key, val);
+    }
+}
+
+static void config_parse(io_config_t *cfg, char *text)
+{
+    for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        char *key, *val, *end;
+
+        if ((end = strchr(line, '#')))
+            *end = 0;
+
+        for (key = line; isspace(*key); ++key);
+        for (end = key; *end && !isspace(*end) && *end != '='; ++end);
+        for (val = end; isspace(*val) || *val == '='; ++val);
+
+        *end = 0;
+
+        for (end = val + strlen(val); end > val && isspace(end[-1]); --end);
+
+        *end = 0;
+
+        if (*key && *val)
+            config_set(cfg, key, val);
+    }
+}
+
+/*
+ * Collective over comm. Only the root reads fname (which may be NULL), and
+ * broadcasts its contents.
+ */
+int io_config_init(io_config_t *cfg, char const *fname, MPI_Comm comm)
+{
+    int myrank;
+    long len = 0;
+    char *text = NULL;
+
+    if (!cfg) return -1;
+
+    *cfg = (io_config_t){MPI_INFO_NULL, 0, 0};
+    mpi_info(comm, &myrank, NULL);
+
+    if (!myrank && fname)
+    {
+        FILE *f = fopen(fname, "r");
+
+        if (f)
+        {
+            fseek(f, 0, SEEK_END);
+            len = ftell(f);
+            rewind(f);
+
+            text = malloc(len + 1);
+            len = fread(text, 1, len, f);
+            fclose(f);
+        }
+        else fprintf(stderr, "io_config_error: could not open '%s', using defaults\n", fname);
+    }
+
+    MPI_Bcast(&len, 1, MPI_LONG, 0, comm);
+
+    if (len > 0)
+    {
+        if (myrank) text = malloc(len + 1);
+
+        MPI_Bcast(text, (int)len, MPI_CHAR, 0, comm);
+        text[len] = 0;
+        config_parse(cfg, text);
+    }
+
+    free(text);
+
+    for (size_t i = 0; i < sizeof(envkeys) / sizeof(envkeys[0]); ++i)
+    {
+        char const *val = getenv(envkeys[i][1]);
+
+        if (val && *val)
+            config_set(cfg, envkeys[i][0], val);
+    }
+
+    if (!cfg->align && cfg->info != MPI_INFO_NULL)
+    {
+        char val[MPI_MAX_INFO_VAL+1];
+        int flag;
+
+        MPI_Info_get(cfg->info, "striping_unit", MPI_MAX_INFO_VAL, val, &flag);
+        if (flag) cfg->align = strtoull(val, NULL, 10);
+    }
+
+    return 0;
+}
+
+int io_config_free(io_config_t *cfg)
+{
+    if (!cfg) return -1;
+
+    if (current == cfg)
+        current = NULL;
+
+    if (cfg->info != MPI_INFO_NULL)
+        MPI_Info_free(&cfg->info);
+
+    *cfg = (io_config_t){MPI_INFO_NULL, 0, 0};
+    return 0;
+}
+
+void io_config_log(const io_config_t cfg, FILE *f)
+{
+    int nkeys = 0;
+
+    if (cfg.info != MPI_INFO_NULL)
+        MPI_Info_get_nkeys(cfg.info, &nkeys);
+
+    fprintf(f, "io_config_log:\n");
+    fprintf(f, "\t%s reads, file domains aligned to %lu bytes\n", cfg.independent? "independent" : "collective", cfg.align);
+
+    for (int i = 0; i < nkeys; ++i)
+    {
+        char key[MPI_MAX_INFO_KEY+1], val[MPI_MAX_INFO_VAL+1];
+        int flag;
+
+        MPI_Info_get_nthkey(cfg.info, i, key);
+        MPI_Info_get(cfg.info, key, MPI_MAX_INFO_VAL, val, &flag);
+        fprintf(f, "\thint %s = %s\n", key, val);
+    }
+
+    fflush(f);
+}
+
+void io_config_set(io_config_t const *cfg)
+{
+    current = cfg;
+}
+
+io_config_t io_config_current(void)
+{
+    if (current)
+        return *current;
+
+    return (io_config_t){MPI_INFO_NULL, 0, 0};
+}
@@ -0,0 +1,40 @@
+#ifndef IO_CONFIG_H_
+#define IO_CONFIG_H_
+
+#include "mpiutil.h"
+
+/*
+ * MPI-IO settings used by every file open and read. Hints are read from a
+ * config file of "key value" (or "key=value") lines, '#' starting a comment,
+ * and then from the environment, which takes precedence:
+ *
+ *     cb_nodes         SEQCOMM_CB_NODES
+ *     cb_buffer_size   SEQCOMM_CB_BUFFER_SIZE
+ *     romio_cb_read    SEQCOMM_ROMIO_CB_READ
+ *     striping_unit    SEQCOMM_STRIPING_UNIT
+ *     align            SEQCOMM_IO_ALIGN
+ *     independent      SEQCOMM_IO_INDEPENDENT
+ *
+ * Other keys in the config file are passed on as hints unchanged. align is
+ * the file domain alignment in bytes (default: striping_unit, if given) and
+ * independent selects independent instead of collective reads.
+ */
+typedef struct
+{
+    MPI_Info info;   /* hints for MPI_File_open, MPI_INFO_NULL if none */
+    size_t align;    /* file domain alignment in bytes, 0 for none */
+    int independent; /* read with independent instead of collective I/O */
+} io_config_t;
+
+int io_config_init(io_config_t *cfg, char const *fname, MPI_Comm comm);
+int io_config_free(io_config_t *cfg);
+void io_config_log(const io_config_t cfg, FILE *f);
+
+/*
+ * Make cfg the configuration used by fasta_index_read and the seq_store
+ * readers (cfg must outlive them), or go back to the defaults if NULL.
+ */
+void io_config_set(io_config_t const *cfg);
+io_config_t io_config_current(void);
+
+#endif
@@ -0,0 +1,246 @@
+#include "kmer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/*
+ * Note: buffer words are loaded with memcpy, which assumes a little-endian
+ * host so that base i of a word sits at bits 2*i and 2*i+1, exactly as
+ * push() in seq_store.c packs them into bytes.
+ */
+
+typedef uint64_t kmer_vec_t __attribute__((vector_size(KMER_LANES * sizeof(uint64_t))));
+
+static inline uint64_t kmer_mask(int k)
+{
+    return k == 32? ~0ULL : (1ULL << (2*k)) - 1;
+}
+
+/*
+ * Load the (up to) 32 bases starting at base position pos, which must be a
+ * multiple of 32, without reading past the end of the sequence's bytes.
+ */
+static inline uint64_t load_word(const uint8_t *buf, size_t len, size_t pos)
+{
+    uint64_t word = 0;
+    size_t numbytes = (len + 3) / 4;
+    size_t bytepos = pos / 4;
+    size_t cnt = numbytes - bytepos < 8? numbytes - bytepos : 8;
+
+    memcpy(&word, buf + bytepos, cnt);
+    return word;
+}
+
+int kmer_iter_init(kmer_iter_t *it, const seq_store_t store, size_t lid, int k)
+{
+    if (!it || k < 1 || k > KMER_MAX_K || lid >= store.numseqs)
+        return -1;
+
+    *it = (kmer_iter_t){0};
+    it->buf = store.buf + seq_store_offset(store, lid);
+    it->len = seq_store_length(store, lid);
+    it->mask = kmer_mask(k);
+    it->k = k;
+    it->shift = 2*(k-1);
+
+    return 0;
+}
+
+/*
+ * Produce the next canonical k-mer and its starting position. Returns 1 if a
+ * k-mer was produced and 0 once the sequence is exhausted.
+ */
+int kmer_iter_next(kmer_iter_t *it, uint64_t *kmer, size_t *pos)
+{
+    while (it->pos < it->len)
+    {
+        if (it->wordbases == 0)
+        {
+            it->word = load_word(it->buf, it->len, it->pos);
+            it->wordbases = 32;
+        }
+
+        uint64_t base = it->word & 3;
+        it->word >>= 2;
+        it->wordbases--;
+
+        it->fw = ((it->fw << 2) | base) & it->mask;
+        it->rc = (it->rc >> 2) | ((base ^ 3) << it->shift);
+
+        if (++it->pos >= (size_t)it->k)
+        {
+            *kmer = it->fw < it->rc? it->fw : it->rc;
+            if (pos) *pos = it->pos - it->k;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int minimizer_iter_init(minimizer_iter_t *it, const seq_store_t store, size_t lid, int w, int k)
+{
+    if (!it || w < 1 || w > KMER_MAX_W)
+        return -1;
+
+    it->w = w;
+    it->filled = it->head = it->minidx = 0;
+    it->lastpos = SIZE_MAX;
+
+    return kmer_iter_init(&it->kmers, store, lid, k);
+}
+
+/*
+ * Produce the next (w,k)-minimizer, i.e. the canonical k-mer with the smallest
+ * hash in each window of w consecutive k-mers (leftmost on ties). Minimizers
+ * shared by consecutive windows are produced once. Sequences too short for a
+ * full window produce the minimizer of their only partial window.
+ */
+int minimizer_iter_next(minimizer_iter_t *it, uint64_t *kmer, size_t *pos)
+{
+    uint64_t fw;
+    size_t fwpos;
+
+    while (kmer_iter_next(&it->kmers, &fw, &fwpos))
+    {
+        uint64_t hash = kmer_hash(fw, it->kmers.mask);
+        int slot, evicted = 0;
+
+        if (it->filled < it->w)
+        {
+            slot = it->filled++;
+        }
+        else
+        {
+            slot = it->head;
+            evicted = (slot == it->minidx);
+            it->head = (it->head + 1) % it->w;
+        }
+
+        it->hashes[slot] = hash;
+        it->kmers_[slot] = fw;
+        it->positions[slot] = fwpos;
+
+        /*
+         * If the previous minimizer was evicted, rescan the window from the
+         * oldest k-mer; otherwise only the new k-mer can replace it.
+         */
+        if (evicted)
+        {
+            it->minidx = it->head;
+
+            for (int i = 1; i < it->w; ++i)
+            {
+                int j = (it->head + i) % it->w;
+
+                if (it->hashes[j] < it->hashes[it->minidx])
+                    it->minidx = j;
+            }
+        }
+        else if (slot == 0 && it->filled == 1)
+        {
+            it->minidx = slot;
+        }
+        else if (hash < it->hashes[it->minidx])
+        {
+            it->minidx = slot;
+        }
+
+        if (it->filled < it->w)
+            continue;
+
+        if (it->positions[it->minidx] != it->lastpos)
+        {
+            it->lastpos = it->positions[it->minidx];
+            *kmer = it->kmers_[it->minidx];
+            if (pos) *pos = it->lastpos;
+            return 1;
+        }
+    }
+
+    if (it->filled > 0 && it->filled < it->w && it->lastpos == SIZE_MAX)
+    {
+        it->lastpos = it->positions[it->minidx];
+        *kmer = it->kmers_[it->minidx];
+        if (pos) *pos = it->lastpos;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the canonical k-mers of local sequences [first, first+count) to
+ * kmers, sequence after sequence, and return how many were written. The
+ * caller sizes kmers with kmer_count. KMER_LANES sequences are rolled in
+ * lockstep using vector extensions, so the shift/mask/min work runs on SIMD
+ * registers.
+ */
+size_t kmer_batch(const seq_store_t store, size_t first, size_t count, int k, uint64_t *kmers)
+{
+    assert(k >= 1 && k <= KMER_MAX_K);
+    assert(first + count <= store.numseqs);
+
+    uint64_t mask = kmer_mask(k);
+    int shift = 2*(k-1);
+    size_t total = 0;
+
+    for (size_t b = 0; b < count; b += KMER_LANES)
+    {
+        const uint8_t *bufs[KMER_LANES];
+        size_t lens[KMER_LANES], outs[KMER_LANES];
+        size_t maxlen = 0;
+        size_t offset = seq_store_offset(store, first + b);
+
+        for (int l = 0; l < KMER_LANES; ++l)
+        {
+            size_t lid = first + b + l;
+
+            if (b + l < count)
+            {
+                lens[l] = seq_store_length(store, lid);
+                bufs[l] = store.buf + offset;
+                outs[l] = total;
+                offset += (lens[l] + 3) / 4;
+                total += kmer_count(store, lid, k);
+                maxlen = maxlen > lens[l]? maxlen : lens[l];
+            }
+            else
+            {
+                lens[l] = 0;
+                bufs[l] = NULL;
+                outs[l] = 0;
+            }
+        }
+
+        kmer_vec_t fw = {0}, rc = {0}, words = {0};
+
+        for (size_t t = 0; t < maxlen; ++t)
+        {
+            if (t % 32 == 0)
+            {
+                for (int l = 0; l < KMER_LANES; ++l)
+                    words[l] = t < lens[l]? load_word(bufs[l], lens[l], t) : 0;
+            }
+
+            kmer_vec_t bases = words & 3;
+            words >>= 2;
+
+            fw = ((fw << 2) | bases) & mask;
+            rc = (rc >> 2) | ((bases ^ 3) << shift);
+
+            if (t + 1 >= (size_t)k)
+            {
+                kmer_vec_t lt = (kmer_vec_t)(fw < rc);
+                kmer_vec_t canon = rc ^ ((fw ^ rc) & lt);
+
+                for (int l = 0; l < KMER_LANES; ++l)
+                    if (t < lens[l])
+                        kmers[outs[l] + t + 1 - k] = canon[l];
+            }
+        }
+    }
+
+    return total;
+}
@@ -0,0 +1,84 @@
+#ifndef KMER_H_
+#define KMER_H_
+
+#include "seq_store.h"
+#include <stdint.h>
+
+/*
+ * Canonical k-mers (k <= 32, 2 bits per base in a uint64_t) and (w,k)-minimizers
+ * extracted directly from the packed 2-bit buffer of a seq_store_t, without
+ * decoding sequences back to ASCII.
+ */
+
+#define KMER_MAX_K 32
+#define KMER_MAX_W 256
+#define KMER_LANES 8 /* sequences processed in lockstep by kmer_batch */
+
+typedef struct
+{
+    const uint8_t *buf; /* packed sequence */
+    size_t len;         /* sequence length */
+    size_t pos;         /* next base to be consumed */
+    uint64_t word;      /* not yet consumed bases of the current buffer word */
+    int wordbases;      /* number of bases left in word */
+    uint64_t fw, rc;    /* forward and reverse complement k-mers ending before pos */
+    uint64_t mask;
+    int k, shift;
+} kmer_iter_t;
+
+typedef struct
+{
+    kmer_iter_t kmers;
+    int w;
+    int filled;    /* number of k-mers currently in the window */
+    int head;      /* ring index of the oldest k-mer in the window */
+    int minidx;    /* ring index of the current minimizer */
+    size_t lastpos; /* position of the last emitted minimizer */
+    uint64_t hashes[KMER_MAX_W];
+    uint64_t kmers_[KMER_MAX_W];
+    size_t positions[KMER_MAX_W];
+} minimizer_iter_t;
+
+/*
+ * Reverse complement of a k-mer: complement every base and reverse the
+ * order of the 2-bit groups with byte swap and in-register swaps.
+ */
+static inline uint64_t kmer_revcomp(uint64_t kmer, int k)
+{
+    kmer = ~kmer;
+    kmer = __builtin_bswap64(kmer);
+    kmer = ((kmer >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((kmer & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    kmer = ((kmer >> 2) & 0x3333333333333333ULL) | ((kmer & 0x3333333333333333ULL) << 2);
+    return kmer >> (64 - 2*k);
+}
+
+/*
+ * Invertible 64-bit integer hash used to order k-mers for minimizer selection.
+ */
+static inline uint64_t kmer_hash(uint64_t kmer, uint64_t mask)
+{
+    kmer = (~kmer + (kmer << 21)) & mask;
+    kmer = kmer ^ (kmer >> 24);
+    kmer = ((kmer + (kmer << 3)) + (kmer << 8)) & mask;
+    kmer = kmer ^ (kmer >> 14);
+    kmer = ((kmer + (kmer << 2)) + (kmer << 4)) & mask;
+    kmer = kmer ^ (kmer >> 28);
+    kmer = (kmer + (kmer << 31)) & mask;
+    return kmer;
+}
+
+static inline size_t kmer_count(const seq_store_t store, size_t lid, int k)
+{
+    size_t len = seq_store_length(store, lid);
+    return len < (size_t)k? 0 : len - k + 1;
+}
+
+int kmer_iter_init(kmer_iter_t *it, const seq_store_t store, size_t lid, int k);
+int kmer_iter_next(kmer_iter_t *it, uint64_t *kmer, size_t *pos);
+
+int minimizer_iter_init(minimizer_iter_t *it, const seq_store_t store, size_t lid, int w, int k);
+int minimizer_iter_next(minimizer_iter_t *it, uint64_t *kmer, size_t *pos);
+
+size_t kmer_batch(const seq_store_t store, size_t first, size_t count, int k, uint64_t *kmers);
+
+#endif
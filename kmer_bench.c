@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "mpiutil.h"
+#include "fasta_index.h"
+#include "seq_store.h"
+#include "kmer.h"
+
+/*
+ * Compares canonical k-mer extraction by decoding every sequence to ASCII
+ * with seq_store_get and hashing the characters, against kmer_iter_next and
+ * kmer_batch on the packed buffer, over the local, row and column stores.
+ *
+ * usage: kmer_bench <fasta> [k] [w]
+ */
+
+static uint64_t decode_then_hash(const seq_store_t store, int k)
+{
+    uint64_t mask = k == 32? ~0ULL : (1ULL << (2*k)) - 1;
+    uint64_t sum = 0;
+    char *seq = NULL;
+
+    for (size_t i = 0; i < store.numseqs; ++i)
+    {
+        int len = seq_store_get(store, i, NULL, &seq);
+        uint64_t fw = 0, rc = 0;
+
+        for (int j = 0; j < len; ++j)
+        {
+            uint64_t base = seq[j] == 'A'? 0 : seq[j] == 'C'? 1 : seq[j] == 'G'? 2 : 3;
+
+            fw = ((fw << 2) | base) & mask;
+            rc = (rc >> 2) | ((base ^ 3) << (2*(k-1)));
+
+            if (j+1 >= k)
+                sum += fw < rc? fw : rc;
+        }
+    }
+
+    free(seq);
+    return sum;
+}
+
+static uint64_t packed_iter(const seq_store_t store, int k)
+{
+    uint64_t sum = 0, kmer;
+    kmer_iter_t it;
+
+    for (size_t i = 0; i < store.numseqs; ++i)
+    {
+        kmer_iter_init(&it, store, i, k);
+
+        while (kmer_iter_next(&it, &kmer, NULL))
+            sum += kmer;
+    }
+
+    return sum;
+}
+
+static uint64_t packed_batch(const seq_store_t store, int k)
+{
+    uint64_t sum = 0;
+    size_t maxkmers = 0;
+
+    for (size_t i = 0; i < store.numseqs; i += 1024)
+    {
+        size_t cnt = 0;
+
+        for (size_t j = i; j < i+1024 && j < store.numseqs; ++j)
+            cnt += kmer_count(store, j, k);
+
+        maxkmers = maxkmers > cnt? maxkmers : cnt;
+    }
+
+    uint64_t *kmers = malloc(maxkmers * sizeof(uint64_t));
+
+    for (size_t i = 0; i < store.numseqs; i += 1024)
+    {
+        size_t count = store.numseqs - i < 1024? store.numseqs - i : 1024;
+        size_t n = kmer_batch(store, i, count, k, kmers);
+
+        for (size_t j = 0; j < n; ++j)
+            sum += kmers[j];
+    }
+
+    free(kmers);
+    return sum;
+}
+
+static size_t packed_minimizers(const seq_store_t store, int w, int k)
+{
+    size_t n = 0;
+    uint64_t kmer;
+    minimizer_iter_t it;
+
+    for (size_t i = 0; i < store.numseqs; ++i)
+    {
+        minimizer_iter_init(&it, store, i, w, k);
+
+        while (minimizer_iter_next(&it, &kmer, NULL))
+            n++;
+    }
+
+    return n;
+}
+
+static void bench_store(const seq_store_t store, char const *name, int w, int k, MPI_Comm comm)
+{
+    int myrank;
+    double t[4], maxt[4];
+    uint64_t sums[3];
+    size_t totmin;
+
+    mpi_info(comm, &myrank, NULL);
+
+    t[0] = -MPI_Wtime(); sums[0] = decode_then_hash(store, k); t[0] += MPI_Wtime();
+    t[1] = -MPI_Wtime(); sums[1] = packed_iter(store, k);      t[1] += MPI_Wtime();
+    t[2] = -MPI_Wtime(); sums[2] = packed_batch(store, k);     t[2] += MPI_Wtime();
+    t[3] = -MPI_Wtime(); size_t nmin = packed_minimizers(store, w, k); t[3] += MPI_Wtime();
+
+    int ok = (sums[0] == sums[1] && sums[0] == sums[2]), allok;
+
+    MPI_Reduce(t, maxt, 4, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&ok, &allok, 1, MPI_INT, MPI_LAND, 0, comm);
+    MPI_Reduce(&nmin, &totmin, 1, MPI_SIZE_T, MPI_SUM, 0, comm);
+
+    if (!myrank)
+    {
+        printf("%s_store (k=%d, w=%d): decode+hash %.4fs, packed iter %.4fs, packed batch %.4fs, minimizers %.4fs (%lu) [%s]\n",
+               name, k, w, maxt[0], maxt[1], maxt[2], maxt[3], totmin, allok? "match" : "MISMATCH");
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <fasta> [k] [w]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    const char *fasta_fname = argv[1];
+    int k = argc > 2? atoi(argv[2]) : 31;
+    int w = argc > 3? atoi(argv[3]) : 15;
+
+    char *faidx_fname = malloc(strlen(fasta_fname) + 5);
+    sprintf(faidx_fname, "%s.fai", fasta_fname);
+
+    commgrid_t grid;
+    assert(commgrid_init(&grid) != -1);
+
+    fasta_index_t faidx;
+    fasta_index_read(&faidx, faidx_fname, NULL, &grid);
+
+    seq_store_t store, row_store, col_store;
+    seq_store_read(&store, fasta_fname, faidx);
+    fasta_index_free(&faidx);
+
+    seq_store_share(store, &row_store, &col_store, &grid);
+
+    bench_store(store, "orig", w, k, grid.grid_world);
+    bench_store(row_store, "row", w, k, grid.grid_world);
+    bench_store(col_store, "col", w, k, grid.grid_world);
+
+    seq_store_free(&store);
+    seq_store_free(&row_store);
+    seq_store_free(&col_store);
+    commgrid_free(&grid);
+    free(faidx_fname);
+
+    MPI_Finalize();
+    return 0;
+}
@@ -6,6 +6,11 @@
 #include "mstring.h"
 #include "fasta_index.h"
 #include "seq_store.h"
+#include "seq_dedup.h"
+#include "pair_tasks.h"
+#include "seq_layout.h"
+#include "sketch.h"
+#include "io_config.h"
 
 /*
  * 1. Master process reads .fai file and parses each line into a fasta record.
@@ -26,6 +31,25 @@
  * 7. At this point, every process should have access to the sequence info it needs
  *    in order to use CombBLAS.
  *
+ * If a per-process memory budget (in bytes) is given after the FASTA file name,
+ * steps 3-7 are instead run in as many batches as needed to stay within it.
+ *
+ * If SEQCOMM_SPILL_BUDGET is set, row and column buffers beyond that many
+ * bytes per process are backed by scratch files in SEQCOMM_SCRATCH (or TMPDIR).
+ *
+ * Instead of a single FASTA file, @list reads the FASTA files listed in the file
+ * list (one per line, each with its .fai next to it) as one. It also takes the
+ * memory budget, and is then streamed in batches the same way.
+ *
+ * SEQCOMM_WIRE=on|auto compresses the packed buffers exchanged along rows and
+ * columns (always, or when predicted to pay off at SEQCOMM_WIRE_BW bytes/s).
+ *
+ * SEQCOMM_CRC (any value but off or 0) ships a CRC32C of every sequence with
+ * the shared stores and verifies it on receipt, then reports the mismatches.
+ *
+ * MPI-IO hints and file domain alignment are read from the config file named by
+ * SEQCOMM_IO_CONFIG and from the environment (see io_config.h).
+ *
  */
 
 #define get_faidx_fname(fasta_fname, faidx_fname) \
@@ -34,17 +58,83 @@
         sprintf((faidx_fname), "%s.fai", (fasta_fname)); \
     } while (0)
 
+static int read_fname_list(char const *listname, char ***fnames)
+{
+    FILE *f = fopen(listname, "r");
+    char line[4096];
+    int numfiles = 0;
+
+    *fnames = NULL;
+
+    if (!f)
+    {
+        fprintf(stderr, "main_error: could not open FASTA list '%s'\n", listname);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "\r\n")] = 0;
+
+        if (!*line)
+            continue;
+
+        *fnames = realloc(*fnames, (numfiles + 1) * sizeof(char *));
+        (*fnames)[numfiles++] = strdup(line);
+    }
+
+    fclose(f);
+    return numfiles;
+}
+
+static int log_batch(int batch, int numbatches, seq_store_t const *store, seq_store_t const *row_store, seq_store_t const *col_store, void *arg)
+{
+    string_store_t const *names = arg;
+    char prefix[64];
+
+    sprintf(prefix, "orig_store.batch%d", batch);
+    seq_store_log(*store, prefix, names, MPI_COMM_WORLD);
+
+    sprintf(prefix, "row_store.batch%d", batch);
+    seq_store_log(*row_store, prefix, names, MPI_COMM_WORLD);
+
+    sprintf(prefix, "col_store.batch%d", batch);
+    seq_store_log(*col_store, prefix, names, MPI_COMM_WORLD);
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     MPI_Init(&argc, &argv);
 
     const char *fasta_fname = argv[1];
+    size_t membudget = argc > 2? strtoull(argv[2], NULL, 10) : 0;
     char *faidx_fname;
     get_faidx_fname(fasta_fname, faidx_fname);
 
     commgrid_t grid;
     assert(commgrid_init(&grid) != -1);
 
+    char const *spill_budget = getenv("SEQCOMM_SPILL_BUDGET");
+
+    if (spill_budget)
+        seq_store_set_membudget(strtoull(spill_budget, NULL, 10), getenv("SEQCOMM_SCRATCH"));
+
+    char const *wire = getenv("SEQCOMM_WIRE");
+
+    if (wire && strcmp(wire, "off"))
+        seq_store_set_wire(strcmp(wire, "on")? SEQ_WIRE_AUTO : SEQ_WIRE_ON, getenv("SEQCOMM_WIRE_BW")? atof(getenv("SEQCOMM_WIRE_BW")) : 0);
+
+    char const *crc = getenv("SEQCOMM_CRC");
+
+    if (crc && strcmp(crc, "off") && strcmp(crc, "0"))
+        seq_store_set_crc(1);
+
+    io_config_t iocfg;
+    io_config_init(&iocfg, getenv("SEQCOMM_IO_CONFIG"), grid.grid_world);
+    io_config_set(&iocfg);
+
     fasta_index_t faidx;
     string_store_t *names_ptr;
 
@@ -55,31 +145,151 @@ int main(int argc, char *argv[])
     names_ptr = NULL;
 #endif
 
-    fasta_index_read(&faidx, faidx_fname, names_ptr, &grid);
+    char **fasta_fnames = NULL, **faidx_fnames = NULL;
+    int numfiles = fasta_fname[0] == '@'? read_fname_list(fasta_fname + 1, &fasta_fnames) : 0;
+
+    if (numfiles)
+    {
+        faidx_fnames = malloc(numfiles * sizeof(char *));
+
+        for (int i = 0; i < numfiles; ++i)
+        {
+            faidx_fnames[i] = malloc(strlen(fasta_fnames[i]) + 5);
+            sprintf(faidx_fnames[i], "%s.fai", fasta_fnames[i]);
+        }
+
+        fasta_index_read_files(&faidx, (char const * const *)faidx_fnames, numfiles, names_ptr, &grid);
+    }
+    else fasta_index_read(&faidx, faidx_fname, names_ptr, &grid);
 
 #ifdef USE_NAMES
     sstore_mpi_bcast(names_ptr, 0, grid.grid_world);
 #endif
 
+    if (membudget)
+    {
+        if (numfiles)
+            seq_store_stream_files((char const * const *)fasta_fnames, faidx, membudget, log_batch, names_ptr);
+        else
+            seq_store_stream(fasta_fname, faidx, membudget, log_batch, names_ptr);
+
+        fasta_index_free(&faidx);
+
+#ifdef USE_NAMES
+        string_store_destroy(names);
+#endif
+
+        for (int i = 0; i < numfiles; ++i)
+        {
+            free(fasta_fnames[i]);
+            free(faidx_fnames[i]);
+        }
+
+        free(fasta_fnames);
+        free(faidx_fnames);
+        io_config_free(&iocfg);
+        commgrid_free(&grid);
+        MPI_Finalize();
+        return 0;
+    }
+
     seq_store_t store;
-    seq_store_read(&store, fasta_fname, faidx);
+
+    if (numfiles)
+        seq_store_read_files(&store, (char const * const *)fasta_fnames, faidx);
+    else
+        seq_store_read(&store, fasta_fname, faidx);
+
     seq_store_log(store, "orig_store", names_ptr, grid.grid_world);
 
     fasta_index_free(&faidx);
 
+#ifdef USE_DEDUP
+    /*
+     * Only share one copy of every distinct sequence.
+     */
+    seq_store_t unique_store;
+    seq_dedup_t dedup;
+
+    seq_store_dedup(store, &unique_store, &dedup, grid.grid_world);
+    seq_dedup_report(&dedup, &grid, stdout);
+
+    seq_store_free(&store);
+    store = unique_store;
+#endif
+
+#ifdef USE_SKETCH
+    /*
+     * Candidate pairs from sketches shared along rows and columns.
+     */
+    sketch_set_t sketches, row_sketches, col_sketches;
+    pair_task_t *candidates;
+
+    sketch_store(store, SKETCH_PARAMS_INIT, &sketches);
+    sketch_share(&sketches, &row_sketches, &col_sketches, &grid);
+
+    size_t numcandidates = sketch_candidates(&row_sketches, &col_sketches, 0.1, &candidates);
+    sketch_report(&sketches, store, numcandidates, &grid, stdout);
+
+    free(candidates);
+    sketch_free(&sketches);
+    sketch_free(&row_sketches);
+    sketch_free(&col_sketches);
+#endif
+
     seq_store_t row_store, col_store;
-    seq_store_share(store, &row_store, &col_store, &grid);
+
+    if (seq_store_share_shared(&store, &row_store, &col_store, &grid))
+        fprintf(stderr, "[rank %d] received sequences failed checksum verification\n", grid.gridrank);
+
+    if (spill_budget)
+        seq_store_mem_report(&grid, stdout);
+
+    if (wire && strcmp(wire, "off"))
+        seq_store_wire_report(&grid, stdout);
+
+    if (crc && strcmp(crc, "off") && strcmp(crc, "0"))
+        seq_store_crc_report(&grid, stdout);
 
     seq_store_log(row_store, "row_store", names_ptr, grid.grid_world);
     seq_store_log(col_store, "col_store", names_ptr, grid.grid_world);
 
+#ifdef USE_PAIR_TASKS
+    pair_task_t *tasks;
+    uint64_t work;
+    size_t numtasks = pair_tasks_enumerate(&row_store, &col_store, PAIR_TILE_BYTES, &tasks, &work);
+    pair_tasks_report(numtasks, work, &grid, stdout);
+    free(tasks);
+#endif
+
+#ifdef USE_LAYOUT
+    seq_layout_t layout;
+    seq_layout_build(row_store, 16, SEQ_LAYOUT_INTERLEAVED, &layout);
+    seq_layout_report(&layout, &grid, stdout);
+    seq_layout_free(&layout);
+#endif
+
 #ifdef USE_NAMES
     string_store_destroy(names);
 #endif
 
+#ifdef USE_DEDUP
+    seq_dedup_free(&dedup);
+#endif
+
     seq_store_free(&store);
     seq_store_free(&row_store);
     seq_store_free(&col_store);
+
+    for (int i = 0; i < numfiles; ++i)
+    {
+        free(fasta_fnames[i]);
+        free(faidx_fnames[i]);
+    }
+
+    free(fasta_fnames);
+    free(faidx_fnames);
+    io_config_free(&iocfg);
     commgrid_free(&grid);
 
     MPI_Finalize();
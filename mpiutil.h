@@ -10,6 +10,10 @@
 #include <limits.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct
 {
     int dims;
@@ -69,4 +73,29 @@ static inline size_t up_size_t(size_t x)
     return x+1;
 }
 
+/*
+ * Displacements of consecutive blocks of counts[0..n-1] elements.
+ */
+static inline void partial_sum(int *displs, int *counts, int n)
+{
+    displs[0] = 0;
+
+    for (int i = 0; i < n-1; ++i)
+        displs[i+1] = displs[i] + counts[i];
+}
+
+/*
+ * 64x64->128 bit multiply folded back to 64 bits, the mixing step of the
+ * sequence and string hashes.
+ */
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
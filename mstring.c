@@ -1,5 +1,8 @@
 #include "mstring.h"
+#include "mpiutil.h"
 #include <limits.h>
+#include <stdint.h>
+#include <ctype.h>
 
 #ifndef MPI_SIZE_T
 #if SIZE_MAX == ULONG_MAX
@@ -84,8 +87,153 @@ int string_push(string_t *buf, char *s, size_t len, int keep_null)
     return 0;
 }
 
+/*
+ * Word-at-a-time multiply/xor string hash (wyhash-style mixing).
+ */
+static uint64_t sstore_hash(const char *s, size_t len)
+{
+    uint64_t w, h = 0x9e3779b97f4a7c15ULL ^ len;
+
+    while (len >= 8)
+    {
+        memcpy(&w, s, 8);
+        h = hash_mix(h ^ w, 0xbf58476d1ce4e5b9ULL);
+        s += 8;
+        len -= 8;
+    }
+
+    w = 0;
+    memcpy(&w, s, len);
+
+    return hash_mix(h ^ w, 0x94d049bb133111ebULL);
+}
+
+/*
+ * Returns the slot holding string s, or the empty slot where it would go.
+ */
+static size_t sstore_probe(const string_store_t *store, uint64_t hash, const char *s, size_t len)
+{
+    const sstore_index_t *index = store->index;
+    size_t mask = index->num_slots-1;
+    size_t i = hash & mask;
+
+    for (;;)
+    {
+        const sstore_slot_t *slot = &index->slots[i];
+
+        if (slot->id == SSTORE_NOTFOUND)
+            return i;
+
+        if (slot->hash == hash && sstore_get_string_length(*store, slot->id) == len &&
+            !memcmp(store->buf.buf + store->displs[slot->id], s, len))
+            return i;
+
+        i = (i+1) & mask;
+    }
+}
+
+static void sstore_index_resize_prv(sstore_index_t *index, size_t num_slots)
+{
+    sstore_slot_t *old = index->slots;
+    size_t old_num_slots = index->num_slots;
+    size_t mask = num_slots-1;
+
+    index->slots = malloc(num_slots * sizeof(sstore_slot_t));
+    index->num_slots = num_slots;
+
+    for (size_t i = 0; i < num_slots; ++i)
+        index->slots[i].id = SSTORE_NOTFOUND;
+
+    /*
+     * Rehashing only needs the cached hashes, never the strings themselves.
+     */
+    for (size_t i = 0; i < old_num_slots; ++i)
+    {
+        if (old[i].id == SSTORE_NOTFOUND)
+            continue;
+
+        size_t j = old[i].hash & mask;
+
+        while (index->slots[j].id != SSTORE_NOTFOUND)
+            j = (j+1) & mask;
+
+        index->slots[j] = old[i];
+    }
+
+    free(old);
+}
+
+/*
+ * Insert string id into the index. Duplicate strings keep their first id.
+ */
+static void sstore_index_insert_prv(string_store_t *store, size_t id)
+{
+    sstore_index_t *index = store->index;
+
+    /* keep the load factor at or below 3/4 */
+    if (4*(index->num_keys+1) > 3*index->num_slots)
+        sstore_index_resize_prv(index, 2*index->num_slots);
+
+    const char *s = store->buf.buf + store->displs[id];
+    size_t len = sstore_get_string_length(*store, id);
+    uint64_t hash = sstore_hash(s, len);
+    size_t i = sstore_probe(store, hash, s, len);
+
+    if (index->slots[i].id == SSTORE_NOTFOUND)
+    {
+        index->slots[i] = (sstore_slot_t){hash, id};
+        index->num_keys++;
+    }
+}
+
+/*
+ * Give a store that borrows its buffer, or whose strings are not packed
+ * back to back, a packed buffer of its own before it grows.
+ */
+static void sstore_own_prv(string_store_t *store)
+{
+    size_t len = store->buf.len;
+
+    if (store->lens)
+    {
+        len = 0;
+
+        for (size_t i = 0; i < store->num_strings; ++i)
+            len += store->lens[i];
+    }
+
+    char *buf = malloc(len + 1);
+
+    if (store->lens)
+    {
+        size_t pos = 0;
+
+        for (size_t i = 0; i < store->num_strings; ++i)
+        {
+            memcpy(buf + pos, store->buf.buf + store->displs[i], store->lens[i]);
+            store->displs[i] = pos;
+            pos += store->lens[i];
+        }
+
+        free(store->lens);
+        store->lens = NULL;
+    }
+    else memcpy(buf, store->buf.buf, len);
+
+    buf[len] = '\0';
+
+    if (!store->borrowed)
+        free(store->buf.buf);
+
+    store->buf = (string_t){buf, len, len + 1};
+    store->borrowed = 0;
+}
+
 int sstore_push(string_store_t *store, char *s, size_t len)
 {
+    if (store->borrowed || store->lens)
+        sstore_own_prv(store);
+
     if (store->num_strings+1 > store->avail_displs)
     {
         store->avail_displs = store->num_strings+1;
@@ -98,6 +246,143 @@ int sstore_push(string_store_t *store, char *s, size_t len)
 
     string_push(&store->buf, s, len, 0);
 
+    if (store->index)
+        sstore_index_insert_prv(store, store->num_strings-1);
+
+    return 0;
+}
+
+/*
+ * Bulk append of the first whitespace-delimited field of every line of
+ * buf[0, len), e.g. all the names of a slurped .fai file. Lines are counted
+ * with memchr first, so displs grows once to its exact size, and the fields
+ * are then placed in a second pass.
+ *
+ * SSTORE_COPY copies the fields into the store's buffer and leaves buf alone.
+ * SSTORE_ADOPT moves the fields to the front of buf, which an empty store
+ * then uses as its buffer; it is trimmed and later freed by
+ * string_store_destroy. SSTORE_BORROW leaves buf untouched (it may be a
+ * read-only mapping): an empty store points displs at the fields where they
+ * are and keeps their lengths in lens. A borrowed buf must outlive the
+ * store, which packs a copy of its own before any later push. A store that
+ * already holds strings copies the fields in every mode, and frees an
+ * adopted buf right away.
+ */
+int sstore_push_fields(string_store_t *store, char *buf, size_t len, int mode)
+{
+    char const *end = buf + len;
+    size_t first = store->num_strings, numlines = 0;
+
+    for (char const *p = buf; p < end; ++numlines)
+    {
+        char const *nl = memchr(p, '\n', end - p);
+        p = nl? nl+1 : end;
+    }
+
+    if (first + numlines > store->avail_displs)
+    {
+        store->avail_displs = first + numlines;
+        store->displs = realloc(store->displs, store->avail_displs * sizeof(size_t));
+    }
+
+    if (mode == SSTORE_BORROW && !first)
+    {
+        if (!store->borrowed)
+            free(store->buf.buf);
+
+        store->lens = realloc(store->lens, (numlines? numlines : 1) * sizeof(size_t));
+
+        size_t i = 0;
+
+        for (char const *p = buf; p < end; ++i)
+        {
+            char const *nl = memchr(p, '\n', end - p);
+            char const *eol = nl? nl : end;
+            size_t fieldlen = 0;
+
+            while (p + fieldlen < eol && !isspace((unsigned char)p[fieldlen]))
+                fieldlen++;
+
+            store->displs[i] = p - buf;
+            store->lens[i] = fieldlen;
+            p = nl? nl+1 : end;
+        }
+
+        /* buf.len ends at the last field, so nothing past it is ever sent */
+        size_t used = numlines? store->displs[numlines-1] + store->lens[numlines-1] : 0;
+
+        store->buf = (string_t){buf, used, used};
+        store->num_strings = numlines;
+        store->borrowed = 1;
+
+        if (store->index)
+        {
+            for (size_t i = 0; i < numlines; ++i)
+                sstore_index_insert_prv(store, i);
+        }
+
+        return 0;
+    }
+
+    int inplace = mode == SSTORE_ADOPT && !first;
+    char *dest;
+    size_t pos;
+
+    if (inplace)
+    {
+        if (!store->borrowed)
+            free(store->buf.buf);
+
+        free(store->lens);
+        store->lens = NULL;
+
+        dest = buf;
+        pos = 0;
+    }
+    else
+    {
+        if (store->borrowed || store->lens)
+            sstore_own_prv(store);
+
+        /* no field is longer than its line, trimmed below */
+        store->buf.buf = realloc(store->buf.buf, store->buf.len + len + 1);
+        dest = store->buf.buf;
+        pos = store->buf.len;
+    }
+
+    size_t *displs = store->displs + first;
+
+    for (char const *p = buf; p < end; )
+    {
+        char const *nl = memchr(p, '\n', end - p);
+        char const *eol = nl? nl : end;
+        size_t fieldlen = 0;
+
+        while (p + fieldlen < eol && !isspace((unsigned char)p[fieldlen]))
+            fieldlen++;
+
+        *displs++ = pos;
+        memmove(dest + pos, p, fieldlen);
+        pos += fieldlen;
+        p = nl? nl+1 : end;
+    }
+
+    store->num_strings += numlines;
+
+    dest = realloc(dest, pos + 1);
+    dest[pos] = '\0';
+    store->buf = (string_t){dest, pos, pos+1};
+    store->borrowed = 0;
+
+    if (!inplace && mode == SSTORE_ADOPT)
+        free(buf);
+
+    if (store->index)
+    {
+        for (size_t i = first; i < store->num_strings; ++i)
+            sstore_index_insert_prv(store, i);
+    }
+
     return 0;
 }
 
@@ -110,6 +395,10 @@ const char *sstore_get_string(string_store_t store, size_t id)
 size_t sstore_get_string_length(string_store_t store, size_t id)
 {
     assert(id < store.num_strings);
+
+    if (store.lens)
+        return store.lens[id];
+
     size_t endpos = (id == store.num_strings-1)? store.buf.len : store.displs[id+1];
     return endpos - store.displs[id];
 }
@@ -149,7 +438,7 @@ int sstore_mpi_bcast(string_store_t *store, int root, MPI_Comm comm)
     MPI_Comm_size(comm, &nprocs);
     MPI_Comm_rank(comm, &myrank);
 
-    int info[2];
+    int info[3];
     string_t *buf = &store->buf;
 
     if (myrank == root)
@@ -161,28 +450,42 @@ int sstore_mpi_bcast(string_store_t *store, int root, MPI_Comm comm)
         store->displs = realloc(store->displs, store->avail_displs * sizeof(size_t));
 
         string_t *buf = &store->buf;
-        buf->avail = buf->len+1;
-        buf->buf = realloc(buf->buf, buf->avail);
 
-        info[0] = (int)buf->len+1;
+        if (!store->borrowed)
+        {
+            buf->avail = buf->len+1;
+            buf->buf = realloc(buf->buf, buf->avail);
+        }
+
+        info[0] = (int)buf->len;
         info[1] = (int)store->num_strings;
+        info[2] = store->lens != NULL;
     }
 
-    MPI_Bcast(info, 2, MPI_INT, root, comm);
+    MPI_Bcast(info, 3, MPI_INT, root, comm);
 
     if (myrank != root)
     {
-        buf->avail = (size_t)info[0];
-        buf->len = buf->avail-1;
+        sstore_index_free(store);
+
+        buf->len = (size_t)info[0];
+        buf->avail = buf->len+1;
         store->num_strings = store->avail_displs = (size_t)info[1];
+        store->borrowed = 0;
 
         buf->buf = malloc(buf->avail);
+        buf->buf[buf->len] = '\0';
         store->displs = malloc(store->num_strings * sizeof(size_t));
+        store->lens = info[2]? malloc(store->num_strings * sizeof(size_t)) : NULL;
     }
 
+    /* the terminator is not sent, so a borrowed buffer goes out as-is */
     MPI_Bcast(buf->buf, info[0], MPI_CHAR, root, comm);
     MPI_Bcast(store->displs, info[1], MPI_SIZE_T, root, comm);
 
+    if (info[2])
+        MPI_Bcast(store->lens, info[1], MPI_SIZE_T, root, comm);
+
     return 0;
 }
 
@@ -205,6 +508,7 @@ int sstore_mpi_scatter(const string_store_t *sendstore, string_store_t *recvstor
     int *char_sendcounts;
     int *char_displs;
     int char_recvcount;
+    int unpacked = myrank == root && sendstore->lens != NULL;
 
     if (myrank == root)
     {
@@ -224,19 +528,26 @@ int sstore_mpi_scatter(const string_store_t *sendstore, string_store_t *recvstor
 
         string_sendcounts[nprocs-1] = globsize - (nprocs-1)*(globsize / nprocs);
 
+        /*
+         * Every process gets the span of the buffer its strings lie in, as-is
+         * (with whatever is between fields in a borrowed buffer).
+         */
         for (int i = 0; i < nprocs; ++i)
         {
-            for (int j = string_displs[i]; j < string_displs[i] + string_sendcounts[i]; ++j)
+            int first = string_displs[i], last = first + string_sendcounts[i] - 1;
+
+            char_displs[i] = 0;
+
+            if (string_sendcounts[i] > 0)
             {
-                char_sendcounts[i] += sstore_get_string_length(*sendstore, j);
+                char_displs[i] = (int)sendstore->displs[first];
+                char_sendcounts[i] = (int)(sendstore->displs[last] + sstore_get_string_length(*sendstore, last) - sendstore->displs[first]);
             }
-
-            if (i != nprocs-1)
-                char_displs[i+1] = char_displs[i] + char_sendcounts[i];
         }
 
     }
 
+    MPI_Bcast(&unpacked, 1, MPI_INT, root, comm);
     MPI_Scatter(string_sendcounts, 1, MPI_INT, &string_recvcount, 1, MPI_INT, root, comm);
     MPI_Scatter(char_sendcounts, 1, MPI_INT, &char_recvcount, 1, MPI_INT, root, comm);
 
@@ -250,6 +561,11 @@ int sstore_mpi_scatter(const string_store_t *sendstore, string_store_t *recvstor
 
     char_recvbuf[char_recvcount] = 0;
 
+    size_t *lens_recvbuf = unpacked? malloc(string_recvcount * sizeof(size_t)) : NULL;
+
+    if (unpacked)
+        MPI_Scatterv(sendstore->lens, string_sendcounts, string_displs, MPI_SIZE_T, lens_recvbuf, string_recvcount, MPI_SIZE_T, root, comm);
+
     if (myrank == root)
     {
         free(string_sendcounts);
@@ -258,9 +574,7 @@ int sstore_mpi_scatter(const string_store_t *sendstore, string_store_t *recvstor
         free(char_displs);
     }
 
-    int displs_offset;
-    MPI_Exscan(&char_recvcount, &displs_offset, 1, MPI_INT, MPI_SUM, comm);
-    if (!myrank) displs_offset = 0;
+    size_t displs_offset = string_recvcount > 0? displs_recvbuf[0] : 0;
 
     for (int i = 0; i < string_recvcount; ++i)
         displs_recvbuf[i] -= displs_offset;
@@ -268,6 +582,81 @@ int sstore_mpi_scatter(const string_store_t *sendstore, string_store_t *recvstor
     recvstore->buf = (string_t){char_recvbuf, char_recvcount, char_recvcount+1};
     recvstore->displs = displs_recvbuf;
     recvstore->avail_displs = recvstore->num_strings = string_recvcount;
+    recvstore->index = NULL;
+    recvstore->borrowed = 0;
+    recvstore->lens = lens_recvbuf;
+
+    return 0;
+}
+
+int sstore_index_build(string_store_t *store)
+{
+    if (!store) return -1;
+
+    sstore_index_free(store);
+
+    size_t num_slots = (4*store->num_strings)/3 + 1;
+    up2(num_slots);
+    num_slots = num_slots < 16? 16 : num_slots;
+
+    store->index = calloc(1, sizeof(sstore_index_t));
+    sstore_index_resize_prv(store->index, num_slots);
+
+    for (size_t i = 0; i < store->num_strings; ++i)
+        sstore_index_insert_prv(store, i);
 
     return 0;
 }
+
+int sstore_index_free(string_store_t *store)
+{
+    if (!store) return -1;
+
+    if (store->index)
+    {
+        free(store->index->slots);
+        free(store->index);
+        store->index = NULL;
+    }
+
+    return 0;
+}
+
+size_t sstore_lookup(string_store_t store, const char *s, size_t len)
+{
+    assert(store.index != NULL);
+
+    size_t i = sstore_probe(&store, sstore_hash(s, len), s, len);
+    return store.index->slots[i].id;
+}
+
+#define SSTORE_LOOKUP_BATCH 16
+
+void sstore_lookup_batch(string_store_t store, char const * const *s, size_t const *lens, size_t n, size_t *ids)
+{
+    assert(store.index != NULL);
+
+    uint64_t hashes[SSTORE_LOOKUP_BATCH];
+    size_t mask = store.index->num_slots-1;
+
+    /*
+     * Hash a block of keys and prefetch their home slots before probing,
+     * so that the slot cache misses of one block overlap each other.
+     */
+    for (size_t b = 0; b < n; b += SSTORE_LOOKUP_BATCH)
+    {
+        size_t cnt = n-b < SSTORE_LOOKUP_BATCH? n-b : SSTORE_LOOKUP_BATCH;
+
+        for (size_t i = 0; i < cnt; ++i)
+        {
+            hashes[i] = sstore_hash(s[b+i], lens[b+i]);
+            __builtin_prefetch(&store.index->slots[hashes[i] & mask]);
+        }
+
+        for (size_t i = 0; i < cnt; ++i)
+        {
+            size_t slot = sstore_probe(&store, hashes[i], s[b+i], lens[b+i]);
+            ids[b+i] = store.index->slots[slot].id;
+        }
+    }
+}
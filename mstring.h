@@ -11,6 +11,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef struct s_string
 {
@@ -19,14 +24,45 @@ typedef struct s_string
     size_t avail;
 } string_t;
 
+typedef struct s_sstore_slot
+{
+    uint64_t hash; /* cached hash of the string in this slot */
+    size_t id;     /* string id, or SSTORE_NOTFOUND if the slot is empty */
+} sstore_slot_t;
+
+/*
+ * Optional open-addressing (linear probing) hash index from string contents
+ * to string ids. The index only references the store's buf/displs, so it can
+ * be built over a store received by sstore_mpi_bcast or sstore_mpi_scatter
+ * without copying any strings.
+ */
+typedef struct s_sstore_index
+{
+    sstore_slot_t *slots;
+    size_t num_slots; /* always a power of two */
+    size_t num_keys;
+} sstore_index_t;
+
 typedef struct s_string_store
 {
     string_t buf;
     size_t num_strings;
     size_t avail_displs;
     size_t *displs;
+    sstore_index_t *index; /* NULL unless sstore_index_build was called */
+    int borrowed;          /* buf belongs to the caller (see sstore_push_fields) */
+    size_t *lens;          /* string lengths when strings are not packed back to back in buf, else NULL */
 } string_store_t;
 
+#define SSTORE_NOTFOUND ((size_t)-1)
+
+/*
+ * Buffer ownership modes of sstore_push_fields.
+ */
+#define SSTORE_COPY 0   /* copy the fields, the caller keeps the buffer */
+#define SSTORE_ADOPT 1  /* the store takes the buffer over and frees it */
+#define SSTORE_BORROW 2 /* the store points into the buffer, which it never writes or frees */
+
 #define STRING_INIT (string_t){0}
 #define STRING_NEW ((string_t*)calloc(1, sizeof(string_t)))
 
@@ -49,12 +85,15 @@ int string_push(string_t *buf, char *s, size_t len, int keep_null);
 #define STRING_STORE_INIT (string_store_t){0}
 
 #define string_store_destroy(ss) do { \
+    sstore_index_free(&(ss)); \
     free((ss).displs); \
-    string_destroy((ss).buf); \
+    free((ss).lens); \
+    if (!(ss).borrowed) free((ss).buf.buf); \
     memset(&(ss), 0, sizeof(string_store_t)); \
 } while (0);
 
 int sstore_push(string_store_t *store, char *s, size_t len);
+int sstore_push_fields(string_store_t *store, char *buf, size_t len, int mode);
 const char *sstore_get_string(string_store_t store, size_t id);
 size_t sstore_maxlen(string_store_t store);
 size_t sstore_get_string_length(string_store_t store, size_t id);
@@ -63,6 +102,16 @@ char* sstore_get_string_dup(string_store_t store, size_t id);
 int sstore_mpi_scatter(const string_store_t *sendstore, string_store_t *recvstore, int root, MPI_Comm comm);
 int sstore_mpi_bcast(string_store_t *store, int root, MPI_Comm comm);
 
+int sstore_index_build(string_store_t *store);
+int sstore_index_free(string_store_t *store);
+size_t sstore_lookup(string_store_t store, const char *s, size_t len);
+void sstore_lookup_batch(string_store_t store, char const * const *s, size_t const *lens, size_t n, size_t *ids);
+
 #define sstore_push_const(store, s) sstore_push((store), (s), strlen((s)))
+#define sstore_lookup_const(store, s) sstore_lookup((store), (s), strlen((s)))
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
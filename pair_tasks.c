@@ -0,0 +1,213 @@
+#include "pair_tasks.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/*
+ * Split local ids [0, numseqs) into runs whose packed bytes fit in maxbytes
+ * (a single longer sequence gets a run of its own). Returns the number of
+ * runs; their boundaries are written to *tiles.
+ */
+static size_t make_tiles(seq_store_t const *store, size_t maxbytes, size_t **tiles)
+{
+    size_t numtiles = 0, bytes = 0;
+
+    *tiles = malloc((store->numseqs + 1) * sizeof(size_t));
+    (*tiles)[0] = 0;
+
+    for (size_t i = 0; i < store->numseqs; ++i)
+    {
+        size_t n = (seq_store_length(*store, i) + 3) / 4;
+
+        if (bytes + n > maxbytes && bytes > 0)
+        {
+            (*tiles)[++numtiles] = i;
+            bytes = 0;
+        }
+
+        bytes += n;
+    }
+
+    if (store->numseqs > 0)
+        (*tiles)[++numtiles] = store->numseqs;
+
+    return numtiles;
+}
+
+static size_t *resolve_gids(seq_store_t const *store)
+{
+    size_t *gids = malloc(store->numseqs * sizeof(size_t));
+
+    for (size_t r = 0; r < store->numranges; ++r)
+    {
+        size_t end = r+1 < store->numranges? store->ranges[r+1].lid : store->numseqs;
+
+        for (size_t i = store->ranges[r].lid; i < end; ++i)
+            gids[i] = store->ranges[r].gid + (i - store->ranges[r].lid);
+    }
+
+    return gids;
+}
+
+int pair_tile_iter_init(pair_tile_iter_t *it, seq_store_t const *row_store, seq_store_t const *col_store, size_t tilebytes)
+{
+    if (!it || !row_store || !col_store)
+        return -1;
+
+    *it = (pair_tile_iter_t){0};
+    it->row_store = row_store;
+    it->col_store = col_store;
+    it->rowgids = resolve_gids(row_store);
+    it->colgids = resolve_gids(col_store);
+
+    tilebytes = tilebytes? tilebytes : PAIR_TILE_BYTES;
+
+    it->numrowtiles = make_tiles(row_store, tilebytes / 2, &it->rowtiles);
+    it->numcoltiles = make_tiles(col_store, tilebytes / 2, &it->coltiles);
+
+    return 0;
+}
+
+/*
+ * Advance to the next tile. Returns 1 if there is one, 0 when done.
+ */
+int pair_tile_iter_next(pair_tile_iter_t *it)
+{
+    if (it->rowtile >= it->numrowtiles || !it->numcoltiles)
+        return 0;
+
+    it->rowbegin = it->rowtiles[it->rowtile];
+    it->rowend = it->rowtiles[it->rowtile+1];
+    it->colbegin = it->coltiles[it->coltile];
+    it->colend = it->coltiles[it->coltile+1];
+
+    if (++it->coltile == it->numcoltiles)
+    {
+        it->coltile = 0;
+        it->rowtile++;
+    }
+
+    return 1;
+}
+
+/*
+ * Write the owned pairs of the current tile to tasks, which must hold
+ * (rowend-rowbegin)*(colend-colbegin) entries. Returns how many were written.
+ */
+size_t pair_tile_tasks(pair_tile_iter_t const *it, pair_task_t *tasks)
+{
+    size_t n = 0;
+
+    for (size_t i = it->rowbegin; i < it->rowend; ++i)
+    {
+        uint64_t rowlen = seq_store_length(*it->row_store, i);
+
+        for (size_t j = it->colbegin; j < it->colend; ++j)
+        {
+            if (pair_owned(it->rowgids[i], it->colgids[j]))
+                tasks[n++] = (pair_task_t){i, j, rowlen * seq_store_length(*it->col_store, j)};
+        }
+    }
+
+    return n;
+}
+
+int pair_tile_iter_free(pair_tile_iter_t *it)
+{
+    if (!it) return -1;
+
+    free(it->rowgids);
+    free(it->colgids);
+    free(it->rowtiles);
+    free(it->coltiles);
+    *it = (pair_tile_iter_t){0};
+
+    return 0;
+}
+
+/*
+ * All owned pairs of a cell, in tile order. Returns the number of tasks and
+ * their summed work in *totwork.
+ */
+size_t pair_tasks_enumerate(seq_store_t const *row_store, seq_store_t const *col_store, size_t tilebytes, pair_task_t **tasks, uint64_t *totwork)
+{
+    pair_tile_iter_t it;
+    size_t numtasks = 0, avail = 0;
+    uint64_t work = 0;
+
+    *tasks = NULL;
+    pair_tile_iter_init(&it, row_store, col_store, tilebytes);
+
+    while (pair_tile_iter_next(&it))
+    {
+        size_t needed = numtasks + (it.rowend - it.rowbegin) * (it.colend - it.colbegin);
+
+        if (needed > avail)
+        {
+            avail = up_size_t(needed);
+            *tasks = realloc(*tasks, avail * sizeof(pair_task_t));
+        }
+
+        size_t n = pair_tile_tasks(&it, *tasks + numtasks);
+
+        for (size_t i = numtasks; i < numtasks + n; ++i)
+            work += (*tasks)[i].work;
+
+        numtasks += n;
+    }
+
+    pair_tile_iter_free(&it);
+
+    *tasks = realloc(*tasks, numtasks * sizeof(pair_task_t));
+    if (totwork) *totwork = work;
+
+    return numtasks;
+}
+
+/*
+ * Split tasks into numparts contiguous parts of about equal work (e.g. one
+ * per thread). Part p is tasks [bounds[p], bounds[p+1]).
+ */
+void pair_tasks_split(pair_task_t const *tasks, size_t numtasks, int numparts, size_t *bounds)
+{
+    uint64_t total = 0, acc = 0;
+    int part = 1;
+
+    for (size_t i = 0; i < numtasks; ++i)
+        total += tasks[i].work;
+
+    bounds[0] = 0;
+
+    for (size_t i = 0; i < numtasks && part < numparts; ++i)
+    {
+        acc += tasks[i].work;
+
+        while (part < numparts && acc * numparts >= total * part)
+            bounds[part++] = i+1;
+    }
+
+    while (part <= numparts)
+        bounds[part++] = numtasks;
+}
+
+void pair_tasks_report(size_t numtasks, uint64_t totwork, commgrid_t const *grid, FILE *f)
+{
+    size_t sumtasks;
+    uint64_t sumwork, maxwork;
+
+    MPI_Reduce(&numtasks, &sumtasks, 1, MPI_SIZE_T, MPI_SUM, 0, grid->grid_world);
+    MPI_Reduce(&totwork, &sumwork, 1, MPI_UINT64_T, MPI_SUM, 0, grid->grid_world);
+    MPI_Reduce(&totwork, &maxwork, 1, MPI_UINT64_T, MPI_MAX, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        int nprocs = grid->dims * grid->dims;
+        double avgwork = (double)sumwork / nprocs;
+
+        fprintf(f, "pair_tasks_report:\n");
+        fprintf(f, "\t%lu pairs, %lu total work\n", sumtasks, sumwork);
+        fprintf(f, "\twork per cell: max %lu, avg %.1f (imbalance %.3f)\n", maxwork, avgwork, avgwork > 0? maxwork / avgwork : 1.0);
+        fflush(f);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef PAIR_TASKS_H_
+#define PAIR_TASKS_H_
+
+#include "seq_store.h"
+#include "mpiutil.h"
+
+/*
+ * Enumeration of the symmetric all-vs-all comparisons that belong to one
+ * grid cell. Every unordered pair {a,b} of distinct global ids occurs in
+ * exactly two (row_store, col_store) orientations across the grid, (a,b) and
+ * (b,a), possibly in the same cell. Only the orientation selected by
+ * pair_owned is emitted, so every pair is compared exactly once grid-wide.
+ * Choosing the orientation by the parity of a+b, rather than by a < b,
+ * spreads the pairs evenly over the upper and lower triangle cells.
+ */
+static inline int pair_owned(size_t rowgid, size_t colgid)
+{
+    if (rowgid == colgid) return 0;
+    return (rowgid < colgid) == !((rowgid + colgid) & 1);
+}
+
+typedef struct
+{
+    size_t row, col; /* local ids in row_store and col_store */
+    uint64_t work;   /* estimated work, the product of the two lengths */
+} pair_task_t;
+
+/*
+ * Cache-blocked traversal of row_store x col_store: each tile spans a run of
+ * row sequences and a run of column sequences whose packed bytes together fit
+ * in tilebytes, so that a kernel run on a tile's pairs finds both operands in
+ * cache. Column tiles vary fastest.
+ */
+typedef struct
+{
+    seq_store_t const *row_store, *col_store;
+    size_t *rowgids, *colgids;       /* global ids, resolved once */
+    size_t *rowtiles, *coltiles;     /* tile boundaries (local ids) */
+    size_t numrowtiles, numcoltiles;
+    size_t rowtile, coltile;         /* next tile */
+    size_t rowbegin, rowend, colbegin, colend; /* current tile */
+} pair_tile_iter_t;
+
+#define PAIR_TILE_BYTES (256*1024)
+
+int pair_tile_iter_init(pair_tile_iter_t *it, seq_store_t const *row_store, seq_store_t const *col_store, size_t tilebytes);
+int pair_tile_iter_next(pair_tile_iter_t *it);
+size_t pair_tile_tasks(pair_tile_iter_t const *it, pair_task_t *tasks);
+int pair_tile_iter_free(pair_tile_iter_t *it);
+
+size_t pair_tasks_enumerate(seq_store_t const *row_store, seq_store_t const *col_store, size_t tilebytes, pair_task_t **tasks, uint64_t *totwork);
+void pair_tasks_split(pair_task_t const *tasks, size_t numtasks, int numparts, size_t *bounds);
+void pair_tasks_report(size_t numtasks, uint64_t totwork, commgrid_t const *grid, FILE *f);
+
+#endif
@@ -0,0 +1,294 @@
+#include "seq_dedup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/*
+ * Sequences are identified by a 128-bit hash of their packed bytes and their
+ * length, so two different sequences are only merged on a full 128-bit
+ * collision.
+ */
+typedef struct
+{
+    uint64_t h1, h2;
+    size_t gid;
+    uint32_t len;
+    uint32_t idx; /* position in the receive buffer (owner side only), < INT_MAX */
+} dedup_key_t;
+
+typedef struct
+{
+    size_t rep;
+    uint32_t count;
+} dedup_reply_t;
+
+static void hash_packed(const uint8_t *buf, size_t len, uint64_t *h1, uint64_t *h2)
+{
+    size_t n = (len + 3) / 4;
+    uint64_t w, a = 0x9e3779b97f4a7c15ULL ^ len, b = 0xc2b2ae3d27d4eb4fULL ^ len;
+
+    while (n >= 8)
+    {
+        memcpy(&w, buf, 8);
+        a = hash_mix(a ^ w, 0xbf58476d1ce4e5b9ULL);
+        b = hash_mix(b ^ w, 0x94d049bb133111ebULL);
+        buf += 8;
+        n -= 8;
+    }
+
+    w = 0;
+    memcpy(&w, buf, n);
+
+    *h1 = hash_mix(a ^ w, 0xff51afd7ed558ccdULL);
+    *h2 = hash_mix(b ^ w, 0xc4ceb9fe1a85ec53ULL);
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+    const dedup_key_t *x = a, *y = b;
+
+    if (x->h1 != y->h1) return x->h1 < y->h1? -1 : 1;
+    if (x->h2 != y->h2) return x->h2 < y->h2? -1 : 1;
+    if (x->len != y->len) return x->len < y->len? -1 : 1;
+    if (x->gid != y->gid) return x->gid < y->gid? -1 : 1;
+    return 0;
+}
+
+/*
+ * Each sequence's hash is routed to the process that owns the hash (h1 mod
+ * nprocs) with one MPI_Alltoallv. Owners sort the keys they received, elect
+ * the smallest global id of every group of equal keys as representative, and
+ * send back the representative and group size with a second MPI_Alltoallv.
+ * unique_store receives the local sequences that are their own
+ * representative.
+ */
+int seq_store_dedup(const seq_store_t store, seq_store_t *unique_store, seq_dedup_t *dedup, MPI_Comm comm)
+{
+    int nprocs;
+
+    if (!unique_store || !dedup)
+        return -1;
+
+    mpi_info(comm, NULL, &nprocs);
+
+    size_t numseqs = store.numseqs;
+    dedup_key_t *keys = malloc(numseqs * sizeof(dedup_key_t));
+    int *owners = malloc(numseqs * sizeof(int));
+    size_t *sendsizes = calloc(nprocs, sizeof(size_t));
+    size_t *recvsizes = malloc(nprocs * sizeof(size_t));
+    int *sendcnts = malloc(nprocs * sizeof(int));
+    int *recvcnts = malloc(nprocs * sizeof(int));
+    int *sdispls = malloc(nprocs * sizeof(int));
+    int *rdispls = malloc(nprocs * sizeof(int));
+    int *pos = malloc(nprocs * sizeof(int));
+
+    /*
+     * Hash and bucket the keys by owner.
+     */
+    for (size_t i = 0; i < numseqs; ++i)
+    {
+        uint64_t h1, h2;
+        size_t len = seq_store_length(store, i);
+
+        hash_packed(store.buf + seq_store_offset(store, i), len, &h1, &h2);
+        owners[i] = (int)(h1 % nprocs);
+        sendsizes[owners[i]]++;
+
+        keys[i] = (dedup_key_t){h1, h2, seq_store_gid(store, i), (uint32_t)len, 0};
+    }
+
+    MPI_Alltoall(sendsizes, 1, MPI_SIZE_T, recvsizes, 1, MPI_SIZE_T, comm);
+
+    size_t numrecv = 0;
+
+    for (int i = 0; i < nprocs; ++i)
+        numrecv += recvsizes[i];
+
+    /* counts and displacements are int, and so are the owners' key indices */
+    int toobig = numseqs > INT_MAX || numrecv > INT_MAX;
+    MPI_Allreduce(MPI_IN_PLACE, &toobig, 1, MPI_INT, MPI_LOR, comm);
+
+    if (toobig)
+    {
+        if (numseqs > INT_MAX || numrecv > INT_MAX)
+            fprintf(stderr, "seq_store_dedup_error: %lu keys sent and %lu received, at most %d each\n", numseqs, numrecv, INT_MAX);
+
+        free(keys);
+        free(owners);
+        free(sendsizes);
+        free(recvsizes);
+        free(sendcnts);
+        free(recvcnts);
+        free(sdispls);
+        free(rdispls);
+        free(pos);
+
+        return -1;
+    }
+
+    for (int i = 0; i < nprocs; ++i)
+    {
+        sendcnts[i] = (int)sendsizes[i];
+        recvcnts[i] = (int)recvsizes[i];
+    }
+
+    partial_sum(sdispls, sendcnts, nprocs);
+    partial_sum(rdispls, recvcnts, nprocs);
+    dedup_key_t *sendkeys = malloc(numseqs * sizeof(dedup_key_t));
+    dedup_key_t *recvkeys = malloc(numrecv * sizeof(dedup_key_t));
+    size_t *slots = malloc(numseqs * sizeof(size_t));
+
+    memcpy(pos, sdispls, nprocs * sizeof(int));
+
+    for (size_t i = 0; i < numseqs; ++i)
+    {
+        slots[i] = pos[owners[i]]++;
+        sendkeys[slots[i]] = keys[i];
+    }
+
+    MPI_Datatype key_mpi_t, reply_mpi_t;
+    MPI_Type_contiguous(sizeof(dedup_key_t), MPI_BYTE, &key_mpi_t);
+    MPI_Type_contiguous(sizeof(dedup_reply_t), MPI_BYTE, &reply_mpi_t);
+    MPI_Type_commit(&key_mpi_t);
+    MPI_Type_commit(&reply_mpi_t);
+
+    MPI_Alltoallv(sendkeys, sendcnts, sdispls, key_mpi_t, recvkeys, recvcnts, rdispls, key_mpi_t, comm);
+
+    /*
+     * Owner side: group equal keys and elect representatives.
+     */
+    dedup_reply_t *replies = malloc(numrecv * sizeof(dedup_reply_t));
+
+    for (size_t i = 0; i < numrecv; ++i)
+        recvkeys[i].idx = (uint32_t)i;
+
+    qsort(recvkeys, numrecv, sizeof(dedup_key_t), key_cmp);
+
+    for (size_t i = 0; i < numrecv; )
+    {
+        size_t j = i+1;
+
+        while (j < numrecv && recvkeys[j].h1 == recvkeys[i].h1 && recvkeys[j].h2 == recvkeys[i].h2 && recvkeys[j].len == recvkeys[i].len)
+            j++;
+
+        for (size_t k = i; k < j; ++k)
+            replies[recvkeys[k].idx] = (dedup_reply_t){recvkeys[i].gid, (uint32_t)(j-i)};
+
+        i = j;
+    }
+
+    dedup_reply_t *myreplies = malloc(numseqs * sizeof(dedup_reply_t));
+
+    MPI_Alltoallv(replies, recvcnts, rdispls, reply_mpi_t, myreplies, sendcnts, sdispls, reply_mpi_t, comm);
+
+    MPI_Type_free(&key_mpi_t);
+    MPI_Type_free(&reply_mpi_t);
+
+    /*
+     * Keep the sequences that represent their group.
+     */
+    uint8_t *keep = malloc(numseqs);
+
+    *dedup = (seq_dedup_t){0};
+    dedup->numseqs = numseqs;
+    dedup->reps = malloc(numseqs * sizeof(size_t));
+    dedup->counts = malloc(numseqs * sizeof(uint32_t));
+
+    for (size_t i = 0; i < numseqs; ++i)
+    {
+        dedup_reply_t reply = myreplies[slots[i]];
+
+        dedup->reps[i] = reply.rep;
+        keep[i] = (reply.rep == keys[i].gid);
+
+        if (keep[i])
+            dedup->counts[dedup->numunique++] = reply.count;
+        else
+            dedup->dupbytes += (keys[i].len + 3) / 4;
+    }
+
+    dedup->counts = realloc(dedup->counts, dedup->numunique * sizeof(uint32_t));
+
+    seq_store_select(store, keep, unique_store);
+
+    free(keep);
+    free(myreplies);
+    free(replies);
+    free(slots);
+    free(sendkeys);
+    free(recvkeys);
+    free(keys);
+    free(owners);
+    free(sendsizes);
+    free(recvsizes);
+    free(sendcnts);
+    free(recvcnts);
+    free(sdispls);
+    free(rdispls);
+    free(pos);
+
+    return 0;
+}
+
+/*
+ * Gather the multiplicities of the unique store along grid rows and columns,
+ * in the same order as seq_store_share lays out the row and column stores.
+ */
+int seq_dedup_share(const seq_dedup_t *dedup, uint32_t **row_counts, uint32_t **col_counts, commgrid_t const *grid)
+{
+    if (!dedup || !row_counts || !col_counts || !grid)
+        return -1;
+
+    int sendcnt = (int)dedup->numunique;
+    int *recvcnts = malloc(grid->dims * sizeof(int));
+    int *displs = malloc(grid->dims * sizeof(int));
+
+    recvcnts[grid->gridcol] = sendcnt;
+    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, grid->row_world);
+    partial_sum(displs, recvcnts, grid->dims);
+
+    *row_counts = malloc((displs[grid->dims-1] + recvcnts[grid->dims-1]) * sizeof(uint32_t));
+    MPI_Allgatherv(dedup->counts, sendcnt, MPI_UINT32_T, *row_counts, recvcnts, displs, MPI_UINT32_T, grid->row_world);
+
+    recvcnts[grid->gridrow] = sendcnt;
+    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, grid->col_world);
+    partial_sum(displs, recvcnts, grid->dims);
+
+    *col_counts = malloc((displs[grid->dims-1] + recvcnts[grid->dims-1]) * sizeof(uint32_t));
+    MPI_Allgatherv(dedup->counts, sendcnt, MPI_UINT32_T, *col_counts, recvcnts, displs, MPI_UINT32_T, grid->col_world);
+
+    free(recvcnts);
+    free(displs);
+
+    return 0;
+}
+
+void seq_dedup_report(const seq_dedup_t *dedup, commgrid_t const *grid, FILE *f)
+{
+    size_t sums[3] = {dedup->numseqs, dedup->numunique, dedup->dupbytes}, gsums[3];
+
+    MPI_Reduce(sums, gsums, 3, MPI_SIZE_T, MPI_SUM, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        /*
+         * Every stored sequence is replicated to dims row peers and dims column peers.
+         */
+        fprintf(f, "seq_dedup_report:\n");
+        fprintf(f, "\t%lu sequences, %lu unique (%lu duplicates)\n", gsums[0], gsums[1], gsums[0] - gsums[1]);
+        fprintf(f, "\tpacked bytes saved: %lu stored, %lu shared\n", gsums[2], 2 * grid->dims * gsums[2]);
+        fflush(f);
+    }
+}
+
+int seq_dedup_free(seq_dedup_t *dedup)
+{
+    if (!dedup) return -1;
+
+    free(dedup->reps);
+    free(dedup->counts);
+    *dedup = (seq_dedup_t){0};
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef SEQ_DEDUP_H_
+#define SEQ_DEDUP_H_
+
+#include "seq_store.h"
+#include "mpiutil.h"
+
+/*
+ * Exact duplicate removal across all processes. Every sequence with the same
+ * bases is represented by the copy with the smallest global id. Sequences
+ * are compared by length and a 128-bit hash of their packed bytes, never
+ * byte by byte, so distinct sequences are merged (and one of them dropped)
+ * on a full 128-bit hash collision, which is assumed not to happen.
+ *
+ * Every process may send and receive at most INT_MAX keys;
+ * seq_store_dedup returns -1 on every process otherwise.
+ */
+typedef struct
+{
+    size_t numseqs;    /* number of sequences in the input store */
+    size_t *reps;      /* representative global id of each input sequence */
+    size_t numunique;  /* number of sequences in the unique store */
+    uint32_t *counts;  /* multiplicity of each sequence of the unique store */
+    size_t dupbytes;   /* packed bytes of the dropped local duplicates */
+} seq_dedup_t;
+
+int seq_store_dedup(const seq_store_t store, seq_store_t *unique_store, seq_dedup_t *dedup, MPI_Comm comm);
+int seq_dedup_share(const seq_dedup_t *dedup, uint32_t **row_counts, uint32_t **col_counts, commgrid_t const *grid);
+void seq_dedup_report(const seq_dedup_t *dedup, commgrid_t const *grid, FILE *f);
+int seq_dedup_free(seq_dedup_t *dedup);
+
+#endif
@@ -0,0 +1,242 @@
+#include "seq_layout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static inline uint32_t padded_length(size_t len)
+{
+    size_t g = up_size_t(len) / 8;
+
+    g = g > 4? g : 4;
+    return (uint32_t)(((len + g - 1) / g) * g);
+}
+
+typedef struct { uint32_t padlen; size_t lid; } slot_key_t;
+
+static int slot_key_cmp(const void *a, const void *b)
+{
+    const slot_key_t *x = a, *y = b;
+
+    if (x->padlen != y->padlen) return x->padlen < y->padlen? -1 : 1;
+    return x->lid < y->lid? -1 : x->lid > y->lid? 1 : 0;
+}
+
+static inline size_t round_up(size_t n, size_t to)
+{
+    return ((n + to - 1) / to) * to;
+}
+
+int seq_layout_build(const seq_store_t store, int lanes, int interleave, seq_layout_t *layout)
+{
+    if (!layout || lanes < 1)
+        return -1;
+
+    size_t numseqs = store.numseqs;
+    slot_key_t *keys = malloc(numseqs * sizeof(slot_key_t));
+
+    *layout = (seq_layout_t){0};
+    layout->numseqs = numseqs;
+    layout->lanes = lanes;
+    layout->interleave = interleave;
+
+    for (size_t i = 0; i < numseqs; ++i)
+        keys[i] = (slot_key_t){padded_length(seq_store_length(store, i)), i};
+
+    qsort(keys, numseqs, sizeof(slot_key_t), slot_key_cmp);
+
+    layout->lids = malloc(numseqs * sizeof(size_t));
+    layout->slots = malloc(numseqs * sizeof(size_t));
+    layout->lengths = malloc(numseqs * sizeof(uint32_t));
+
+    /*
+     * Buckets and their place in the buffer.
+     */
+    size_t avail = 0;
+
+    for (size_t i = 0; i < numseqs; ++i)
+    {
+        if (i == 0 || keys[i].padlen != keys[i-1].padlen)
+        {
+            if (layout->numbuckets == avail)
+            {
+                avail = avail? 2*avail : 16;
+                layout->buckets = realloc(layout->buckets, avail * sizeof(seq_bucket_t));
+            }
+
+            size_t stride = keys[i].padlen / 4;
+            layout->buckets[layout->numbuckets++] = (seq_bucket_t){keys[i].padlen, stride, i, 0, 0, round_up(stride * lanes, SEQ_LAYOUT_ALIGN)};
+        }
+
+        layout->buckets[layout->numbuckets-1].count++;
+        layout->lids[i] = keys[i].lid;
+        layout->slots[keys[i].lid] = i;
+        layout->lengths[i] = (uint32_t)seq_store_length(store, keys[i].lid);
+    }
+
+    layout->buckets = realloc(layout->buckets, layout->numbuckets * sizeof(seq_bucket_t));
+
+    for (size_t b = 0; b < layout->numbuckets; ++b)
+    {
+        seq_bucket_t *bucket = &layout->buckets[b];
+
+        bucket->offset = layout->numbytes;
+        layout->numbytes += ((bucket->count + lanes - 1) / lanes) * bucket->tilebytes;
+    }
+
+    free(keys);
+
+    if (posix_memalign((void **)&layout->buf, SEQ_LAYOUT_ALIGN, layout->numbytes? layout->numbytes : SEQ_LAYOUT_ALIGN))
+    {
+        seq_layout_free(layout);
+        return -1;
+    }
+
+    memset(layout->buf, 0, layout->numbytes);
+
+    /*
+     * Copy the sequences into their lanes.
+     */
+    for (size_t b = 0; b < layout->numbuckets; ++b)
+    {
+        seq_bucket_t const *bucket = &layout->buckets[b];
+
+        for (size_t k = 0; k < bucket->count; ++k)
+        {
+            size_t slot = bucket->first + k, lane = k % lanes;
+            size_t lid = layout->lids[slot];
+            uint8_t *tile = layout->buf + bucket->offset + (k / lanes) * bucket->tilebytes;
+            uint8_t const *src = store.buf + seq_store_offset(store, lid);
+            size_t n = (layout->lengths[slot] + 3) / 4;
+
+            if (interleave == SEQ_LAYOUT_INTERLEAVED)
+            {
+                for (size_t j = 0; j < n; ++j)
+                    tile[j*lanes + lane] = src[j];
+            }
+            else memcpy(tile + lane * bucket->stride, src, n);
+        }
+    }
+
+    return 0;
+}
+
+int seq_layout_free(seq_layout_t *layout)
+{
+    if (!layout) return -1;
+
+    free(layout->buf);
+    free(layout->lids);
+    free(layout->slots);
+    free(layout->lengths);
+    free(layout->buckets);
+    *layout = (seq_layout_t){0};
+
+    return 0;
+}
+
+/*
+ * Copy the packed sequence in slot into dest, which must hold (len+3)/4
+ * bytes. Returns its length.
+ */
+size_t seq_layout_extract(seq_layout_t const *layout, size_t slot, uint8_t *dest)
+{
+    size_t b = 0, hi = layout->numbuckets;
+
+    /* last bucket with first <= slot */
+    while (hi - b > 1)
+    {
+        size_t mid = (b + hi) / 2;
+
+        if (layout->buckets[mid].first <= slot) b = mid;
+        else hi = mid;
+    }
+
+    seq_bucket_t const *bucket = &layout->buckets[b];
+    size_t k = slot - bucket->first, lane = k % layout->lanes;
+    uint8_t const *tile = layout->buf + bucket->offset + (k / layout->lanes) * bucket->tilebytes;
+    size_t n = (layout->lengths[slot] + 3) / 4;
+
+    if (layout->interleave == SEQ_LAYOUT_INTERLEAVED)
+    {
+        for (size_t j = 0; j < n; ++j)
+            dest[j] = tile[j*layout->lanes + lane];
+    }
+    else memcpy(dest, tile + lane * bucket->stride, n);
+
+    return layout->lengths[slot];
+}
+
+void seq_layout_report(seq_layout_t const *layout, commgrid_t const *grid, FILE *f)
+{
+    size_t bases = 0, padded = 0, lanes = 0, tiles = 0;
+
+    for (size_t b = 0; b < layout->numbuckets; ++b)
+    {
+        seq_bucket_t const *bucket = &layout->buckets[b];
+        size_t ntiles = (bucket->count + layout->lanes - 1) / layout->lanes;
+
+        padded += ntiles * layout->lanes * (size_t)bucket->padlen;
+        lanes += bucket->count;
+        tiles += ntiles;
+    }
+
+    for (size_t i = 0; i < layout->numseqs; ++i)
+        bases += layout->lengths[i];
+
+    size_t sums[4] = {bases, padded, lanes, tiles}, gsums[4], maxbuckets;
+
+    MPI_Reduce(sums, gsums, 4, MPI_SIZE_T, MPI_SUM, 0, grid->grid_world);
+    MPI_Reduce(&layout->numbuckets, &maxbuckets, 1, MPI_SIZE_T, MPI_MAX, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        fprintf(f, "seq_layout_report:\n");
+        fprintf(f, "\t%lu tiles of %d %s lanes, at most %lu length buckets per process\n", gsums[3], layout->lanes,
+                layout->interleave == SEQ_LAYOUT_INTERLEAVED? "interleaved" : "contiguous", maxbuckets);
+        fprintf(f, "\tlane occupancy %.3f, base occupancy %.3f\n", gsums[3]? (double)gsums[2] / (gsums[3] * layout->lanes) : 1.0,
+                gsums[1]? (double)gsums[0] / gsums[1] : 1.0);
+        fflush(f);
+    }
+}
+
+int seq_batch_iter_init(seq_batch_iter_t *it, seq_layout_t const *layout)
+{
+    if (!it || !layout)
+        return -1;
+
+    *it = (seq_batch_iter_t){0};
+    it->layout = layout;
+
+    return 0;
+}
+
+/*
+ * Advance to the next batch. Returns 1 if there is one, 0 when done.
+ */
+int seq_batch_iter_next(seq_batch_iter_t *it)
+{
+    seq_layout_t const *layout = it->layout;
+
+    if (it->bucket >= layout->numbuckets)
+        return 0;
+
+    seq_bucket_t const *bucket = &layout->buckets[it->bucket];
+    size_t done = it->tile * layout->lanes;
+
+    it->data = layout->buf + bucket->offset + it->tile * bucket->tilebytes;
+    it->first = bucket->first + done;
+    it->count = bucket->count - done < (size_t)layout->lanes? bucket->count - done : (size_t)layout->lanes;
+    it->padlen = bucket->padlen;
+    it->lids = layout->lids + it->first;
+    it->lengths = layout->lengths + it->first;
+
+    if (done + layout->lanes >= bucket->count)
+    {
+        it->bucket++;
+        it->tile = 0;
+    }
+    else it->tile++;
+
+    return 1;
+}
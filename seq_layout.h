@@ -0,0 +1,69 @@
+#ifndef SEQ_LAYOUT_H_
+#define SEQ_LAYOUT_H_
+
+#include "seq_store.h"
+#include "mpiutil.h"
+
+/*
+ * Copy of a store's sequences regrouped for batched kernels. Sequences are
+ * put in length buckets, every bucket padding its sequences to one length:
+ * the length rounded up to an eighth of the next power of two (at least 4),
+ * so padding adds less than 1/8. Within a bucket, sequences keep their local
+ * id order and are packed lanes at a time into 64-byte aligned tiles. In a
+ * contiguous layout lane l of a tile occupies bytes [l*stride, (l+1)*stride);
+ * in an interleaved layout byte j of lane l is at j*lanes + l, so one vector
+ * load reads the same position of every lane. Unused lanes of a bucket's
+ * last tile and the padding of every lane are zero.
+ */
+#define SEQ_LAYOUT_CONTIGUOUS 0
+#define SEQ_LAYOUT_INTERLEAVED 1
+
+#define SEQ_LAYOUT_ALIGN 64
+
+typedef struct
+{
+    uint32_t padlen;  /* padded length (bases) of the bucket's sequences */
+    size_t stride;    /* packed bytes per sequence, padlen/4 */
+    size_t first;     /* first slot of the bucket */
+    size_t count;     /* number of sequences */
+    size_t offset;    /* byte offset of the bucket's first tile */
+    size_t tilebytes; /* bytes per tile (a multiple of SEQ_LAYOUT_ALIGN) */
+} seq_bucket_t;
+
+typedef struct
+{
+    uint8_t *buf;          /* SEQ_LAYOUT_ALIGN aligned tiles */
+    size_t numbytes;
+    size_t numseqs;
+    int lanes;             /* sequences per tile */
+    int interleave;        /* SEQ_LAYOUT_* */
+    size_t *lids;          /* local id of the sequence in each slot */
+    size_t *slots;         /* slot of each local id */
+    uint32_t *lengths;     /* actual length of the sequence in each slot */
+    seq_bucket_t *buckets; /* in increasing padded length */
+    size_t numbuckets;
+} seq_layout_t;
+
+/*
+ * A batch is one tile: up to lanes sequences of the same padded length.
+ */
+typedef struct
+{
+    seq_layout_t const *layout;
+    size_t bucket, tile;        /* next batch */
+    uint8_t const *data;        /* current tile */
+    size_t first, count;        /* slots [first, first+count) */
+    uint32_t padlen;            /* their padded length */
+    size_t const *lids;         /* their local ids */
+    uint32_t const *lengths;    /* their actual lengths */
+} seq_batch_iter_t;
+
+int seq_layout_build(const seq_store_t store, int lanes, int interleave, seq_layout_t *layout);
+int seq_layout_free(seq_layout_t *layout);
+size_t seq_layout_extract(seq_layout_t const *layout, size_t slot, uint8_t *dest);
+void seq_layout_report(seq_layout_t const *layout, commgrid_t const *grid, FILE *f);
+
+int seq_batch_iter_init(seq_batch_iter_t *it, seq_layout_t const *layout);
+int seq_batch_iter_next(seq_batch_iter_t *it);
+
+#endif
@@ -1,11 +1,18 @@
 #include "seq_store.h"
 #include "mpiutil.h"
+#include "io_config.h"
+#include "wire_codec.h"
+#include "crc32c.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
 #include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 const uint8_t nt4map[256] =
 {
@@ -30,6 +37,210 @@ const uint8_t nt4map[256] =
     4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4
 };
 
+/*
+ * Budgeted allocator for the buffers of received stores. Buffers that would
+ * take the bytes allocated by it past membudget are instead backed by an
+ * unlinked file in scratchdir mapped with mmap.
+ */
+static size_t membudget = 0; /* 0 means unlimited */
+static char const *scratchdir = NULL;
+static size_t memresident = 0; /* bytes currently malloc'd by buf_alloc */
+static size_t totalloc = 0, totspilled = 0;
+static struct rusage rusage_start;
+
+void seq_store_set_membudget(size_t budget, char const *dir)
+{
+    membudget = budget;
+    scratchdir = dir;
+    totalloc = totspilled = 0;
+    getrusage(RUSAGE_SELF, &rusage_start);
+}
+
+static uint8_t *buf_alloc(size_t numbytes, int *bufkind)
+{
+    totalloc += numbytes;
+
+    if (!membudget || !numbytes || memresident + numbytes <= membudget)
+    {
+        memresident += numbytes;
+        *bufkind = SEQ_BUF_BUDGET;
+        return malloc(numbytes);
+    }
+
+    char const *dir = scratchdir? scratchdir : getenv("TMPDIR");
+    char *path;
+    asprintf(&path, "%s/seqcomm.XXXXXX", dir? dir : "/tmp");
+
+    int fd = mkstemp(path);
+    void *buf = MAP_FAILED;
+
+    if (fd >= 0)
+    {
+        unlink(path);
+
+        if (!ftruncate(fd, numbytes))
+            buf = mmap(NULL, numbytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+        close(fd);
+    }
+
+    free(path);
+
+    if (buf == MAP_FAILED)
+    {
+        fprintf(stderr, "seq_store_error: could not map %lu bytes of scratch space, using the heap\n", numbytes);
+        memresident += numbytes;
+        *bufkind = SEQ_BUF_BUDGET;
+        return malloc(numbytes);
+    }
+
+    /* received data is written front to back */
+    madvise(buf, numbytes, MADV_SEQUENTIAL);
+
+    totspilled += numbytes;
+    *bufkind = SEQ_BUF_MAPPED;
+    return buf;
+}
+
+static void buf_free(uint8_t *buf, size_t numbytes, int bufkind)
+{
+    if (bufkind == SEQ_BUF_BORROWED)
+        return;
+
+    if (bufkind == SEQ_BUF_MAPPED)
+    {
+        if (numbytes) munmap(buf, numbytes);
+        return;
+    }
+
+    if (bufkind == SEQ_BUF_BUDGET)
+        memresident -= numbytes;
+
+    free(buf);
+}
+
+int seq_store_advise(const seq_store_t store, int access)
+{
+    if (store.bufkind != SEQ_BUF_MAPPED || !store.numbytes)
+        return 0;
+
+    return madvise(store.buf, store.numbytes, access == SEQ_STORE_RANDOM? MADV_RANDOM : MADV_SEQUENTIAL);
+}
+
+void seq_store_mem_report(commgrid_t const *grid, FILE *f)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    size_t sums[2] = {totalloc, totspilled};
+    long faults[2] = {ru.ru_minflt - rusage_start.ru_minflt, ru.ru_majflt - rusage_start.ru_majflt};
+    size_t gsums[2];
+    long gfaults[2];
+
+    MPI_Reduce(sums, gsums, 2, MPI_SIZE_T, MPI_SUM, 0, grid->grid_world);
+    MPI_Reduce(faults, gfaults, 2, MPI_LONG, MPI_MAX, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        fprintf(f, "seq_store_mem_report:\n");
+        fprintf(f, "\tbudget per process = %lu bytes\n", membudget);
+        fprintf(f, "\tspilled %lu of %lu buffer bytes (%.2f%%)\n", gsums[1], gsums[0], gsums[0]? (100.0*gsums[1])/gsums[0] : 0.0);
+        fprintf(f, "\tpage faults (max per process): %ld minor, %ld major\n", gfaults[0], gfaults[1]);
+        fflush(f);
+    }
+}
+
+/*
+ * Wire compression of the buffer exchange in allgather_store. In
+ * SEQ_WIRE_AUTO mode, every exchange first predicts, from each process's
+ * compression probe and the network bandwidth wirebw (bytes per second), if
+ * compressing, sending and decompressing beats sending the plain bytes.
+ */
+static int wiremode = SEQ_WIRE_OFF;
+static double wirebw = 1.25e9;
+static size_t wireraw = 0, wiresent = 0; /* own segment bytes, before and after compression */
+static int wireon = 0, wireoff = 0;      /* exchanges done compressed and plain */
+
+void seq_store_set_wire(int mode, double bandwidth)
+{
+    wiremode = mode;
+    wirebw = bandwidth > 0? bandwidth : 1.25e9;
+    wireraw = wiresent = 0;
+    wireon = wireoff = 0;
+}
+
+void seq_store_wire_report(commgrid_t const *grid, FILE *f)
+{
+    size_t sums[2] = {wireraw, wiresent}, gsums[2];
+    int counts[2] = {wireon, wireoff}, gcounts[2];
+
+    MPI_Reduce(sums, gsums, 2, MPI_SIZE_T, MPI_SUM, 0, grid->grid_world);
+    MPI_Reduce(counts, gcounts, 2, MPI_INT, MPI_MAX, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        fprintf(f, "seq_store_wire_report:\n");
+        fprintf(f, "\tmode %s, %d exchanges compressed, %d plain (max per process)\n",
+                wiremode == SEQ_WIRE_ON? "on" : wiremode == SEQ_WIRE_AUTO? "auto" : "off", gcounts[0], gcounts[1]);
+        fprintf(f, "\tcompressed %lu packed bytes to %lu (ratio %.3f)\n", gsums[0], gsums[1], gsums[0]? (double)gsums[1] / gsums[0] : 1.0);
+        fflush(f);
+    }
+}
+
+/*
+ * Per-sequence CRC32C of the packed bytes. When enabled, push checksums every
+ * sequence right after packing it, while its bytes are still in cache, and
+ * the share functions send the checksums along with the lengths and check
+ * every received sequence against them.
+ */
+#define SEQ_CRC_MAXREPORT 8              /* mismatches printed per store */
+#define SEQ_CRC_TESTBYTES (1024*1024)    /* bytes verified between progress tests */
+
+static int crcmode = 0;
+static size_t crcseqs = 0, crcbytes = 0, crcbad = 0; /* sequences and bytes verified, mismatches */
+static double crctime = 0, sharetime = 0;            /* seconds verifying, and in the share functions */
+
+void seq_store_set_crc(int on)
+{
+    crcmode = on;
+    crcseqs = crcbytes = crcbad = 0;
+    crctime = sharetime = 0;
+}
+
+void seq_store_crc_report(commgrid_t const *grid, FILE *f)
+{
+    size_t sums[3] = {crcseqs, crcbytes, crcbad}, gsums[3];
+    double times[2] = {crctime, sharetime}, maxtimes[2];
+
+    MPI_Reduce(sums, gsums, 3, MPI_SIZE_T, MPI_SUM, 0, grid->grid_world);
+    MPI_Reduce(times, maxtimes, 2, MPI_DOUBLE, MPI_MAX, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        fprintf(f, "seq_store_crc_report:\n");
+        fprintf(f, "\tCRC32C (%s): %lu sequences, %lu packed bytes verified, %lu mismatches\n", crc32c_hw()? "sse4.2" : "table", gsums[0], gsums[1], gsums[2]);
+        fprintf(f, "\tverify %.4fs of %.4fs sharing (%.1f%%, max per process)\n", maxtimes[0], maxtimes[1], maxtimes[1] > 0? 100 * maxtimes[0] / maxtimes[1] : 0.0);
+        fflush(f);
+    }
+}
+
+static void push_gid(seq_store_t *store, size_t lid, size_t gid)
+{
+    if (store->numranges > 0)
+    {
+        gid_range_t *last = &store->ranges[store->numranges-1];
+
+        if (last->gid + (lid - last->lid) == gid)
+            return;
+    }
+
+    /* capacity is the next power of two, so grow whenever numranges is one */
+    if ((store->numranges & (store->numranges-1)) == 0)
+        store->ranges = realloc(store->ranges, (store->numranges? 2*store->numranges : 1) * sizeof(gid_range_t));
+
+    store->ranges[store->numranges++] = (gid_range_t){lid, gid};
+}
+
 static void push(seq_store_t *store, char *s, size_t len, size_t *avail, size_t id)
 {
     size_t n = (len + 3) / 4;
@@ -49,63 +260,142 @@ static void push(seq_store_t *store, char *s, size_t len, size_t *avail, size_t
     if (store->numseqs+1 >= *avail)
     {
         *avail = up_size_t(store->numseqs+1);
-        store->lengths = realloc(store->lengths, *avail * sizeof(size_t));
-        store->offsets = realloc(store->offsets, *avail * sizeof(size_t));
-        store->gids = realloc(store->gids, *avail * sizeof(size_t));
+        store->lengths = realloc(store->lengths, *avail * sizeof(uint32_t));
+        store->samples = realloc(store->samples, (*avail / SEQ_STORE_SAMPLE + 1) * sizeof(size_t));
+
+        if (store->crcs)
+            store->crcs = realloc(store->crcs, *avail * sizeof(uint32_t));
+    }
+
+    if (store->checksummed)
+    {
+        if (!store->crcs)
+            store->crcs = malloc(*avail * sizeof(uint32_t));
+
+        store->crcs[store->numseqs] = crc32c(0, store->buf + offset, n);
     }
 
-    store->gids[store->numseqs] = id;
-    store->lengths[store->numseqs] = len;
-    store->offsets[store->numseqs++] = offset;
+    if (store->numseqs % SEQ_STORE_SAMPLE == 0)
+        store->samples[store->numseqs / SEQ_STORE_SAMPLE] = offset;
+
+    push_gid(store, store->numseqs, id);
+    store->lengths[store->numseqs++] = len;
     store->numbytes += n;
 }
 
-int seq_store_read(seq_store_t *store, const char *fname, const fasta_index_t faidx)
+/*
+ * Rebuild the sampled offsets of a store from its lengths.
+ */
+static void sample_offsets(seq_store_t *store)
 {
-    if (!store) return -1;
+    size_t offset = 0;
 
-    *store = (seq_store_t){0};
-    size_t seq_store_avail = 0;
-    size_t num_records = faidx.num_records;
+    store->samples = realloc(store->samples, (store->numseqs / SEQ_STORE_SAMPLE + 1) * sizeof(size_t));
 
-    /* first and last records in my local chunk */
-    fasta_record_t first_record = faidx.records[0];
-    fasta_record_t last_record = faidx.records[num_records-1];
+    for (size_t i = 0; i < store->numseqs; ++i)
+    {
+        if (i % SEQ_STORE_SAMPLE == 0)
+            store->samples[i / SEQ_STORE_SAMPLE] = offset;
 
-    /* position of first and last (exclusive) character within FASTA file that my chunk needs */
-    MPI_Offset startpos = first_record.pos;
-    MPI_Offset endpos = last_record.pos + last_record.len + (last_record.len / last_record.bases);
+        offset += (store->lengths[i] + 3) / 4;
+    }
+}
 
-    MPI_File fh;
-    MPI_CHECK(MPI_File_open(faidx.grid->grid_world, fname, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh));
+/*
+ * Position of the first and last (exclusive) character within the FASTA file
+ * that records[0..n) need.
+ */
+static void records_range(fasta_record_t const *records, size_t n, MPI_Offset filesize, MPI_Offset *startpos, MPI_Offset *endpos)
+{
+    if (n == 0)
+    {
+        *startpos = *endpos = 0;
+        return;
+    }
 
-    MPI_Offset filesize;
-    MPI_CHECK(MPI_File_get_size(fh, &filesize));
+    fasta_record_t first_record = records[0];
+    fasta_record_t last_record = records[n-1];
+
+    *startpos = first_record.pos;
+    *endpos = last_record.pos + last_record.len + (last_record.len / last_record.bases);
 
     /* last process rank may need to adjust end position if the FASTA file isn't terminated with a '\n' */
-    endpos = endpos < filesize? endpos : filesize;
+    *endpos = *endpos < filesize? *endpos : filesize;
+}
 
-    int mychunksize = endpos - startpos;
-    char *mychunk = malloc(mychunksize);
+/*
+ * DUST low-complexity score of a sequence: sum over its distinct
+ * trinucleotides t of c_t*(c_t-1)/2, divided by (number of trinucleotides - 1).
+ */
+static double dust_score(char const *s, size_t len)
+{
+    if (len < 4) return 0.0;
 
-    MPI_CHECK(MPI_File_read_at_all(fh, startpos, mychunk, mychunksize, MPI_CHAR, MPI_STATUS_IGNORE));
-    MPI_CHECK(MPI_File_close(&fh));
+    uint32_t counts[64] = {0};
+    size_t score = 0;
+    int t = ((nt4map[(int)s[0]]&3) << 2) | (nt4map[(int)s[1]]&3);
 
+    for (size_t i = 2; i < len; ++i)
+    {
+        t = ((t << 2) | (nt4map[(int)s[i]]&3)) & 63;
+        score += counts[t]++;
+    }
+
+    return (double)score / (len - 3);
+}
+
+/*
+ * Returns nonzero if the content of sequence s passes filter.
+ */
+static int filter_content(seq_filter_t const *filter, char const *s, size_t len)
+{
+    if (filter->max_n_frac < 1.0)
+    {
+        size_t numn = 0;
+
+        for (size_t i = 0; i < len; ++i)
+            numn += (nt4map[(int)s[i]] > 3 || s[i] == 'N' || s[i] == 'n');
+
+        if (numn > filter->max_n_frac * len)
+            return 0;
+    }
+
+    if (filter->max_dust > 0 && dust_score(s, len) > filter->max_dust)
+        return 0;
+
+    return 1;
+}
+
+/*
+ * Encode records[0..n), whose FASTA bytes starting at startpos are in chunk,
+ * into store with dense global ids gidoffset, gidoffset+1, ... If filter is
+ * given, records failing its content filters are skipped, and the index in
+ * records of every stored sequence is written to kept.
+ */
+static int encode_records(seq_store_t *store, char const *chunk, MPI_Offset startpos, fasta_record_t const *records, size_t n, size_t gidoffset, seq_filter_t const *filter, size_t *kept)
+{
+    *store = (seq_store_t){0};
+    store->checksummed = crcmode;
+
+    size_t seq_store_avail = 0;
     size_t maxlen = 0;
 
-    for (size_t i = 0; i < num_records; ++i)
+    for (size_t i = 0; i < n; ++i)
     {
-        maxlen = maxlen > faidx.records[i].len? maxlen : faidx.records[i].len;
+        maxlen = maxlen > records[i].len? maxlen : records[i].len;
     }
 
-    size_t offset = 0;
-    MPI_Exscan(&num_records, &offset, 1, MPI_SIZE_T, MPI_SUM, faidx.grid->grid_world);
+    if (maxlen > UINT32_MAX)
+    {
+        fprintf(stderr, "seq_store_read_error: sequence of length %lu does not fit in 32 bits\n", maxlen);
+        return -1;
+    }
 
     char *seqbuf = malloc(maxlen);
 
-    for (size_t i = 0; i < num_records; ++i)
+    for (size_t i = 0; i < n; ++i)
     {
-        fasta_record_t *record = faidx.records + i;
+        fasta_record_t const *record = records + i;
         size_t bases = record->bases;
         size_t locpos = 0;
         ptrdiff_t chunkpos = record->pos - startpos;
@@ -115,230 +405,1867 @@ int seq_store_read(seq_store_t *store, const char *fname, const fasta_index_t fa
         while (remain > 0)
         {
             size_t cnt = bases < remain? bases : remain;
-            memcpy(bufptr, mychunk + chunkpos + locpos, cnt);
+            memcpy(bufptr, chunk + chunkpos + locpos, cnt);
             bufptr += cnt;
             remain -= cnt;
             locpos += (cnt+1);
         }
 
-        push(store, seqbuf, record->len, &seq_store_avail, i+offset);
+        if (filter && !filter_content(filter, seqbuf, record->len))
+            continue;
+
+        if (kept) kept[store->numseqs] = i;
+
+        push(store, seqbuf, record->len, &seq_store_avail, gidoffset + store->numseqs);
     }
 
     free(seqbuf);
 
-    store->lengths = realloc(store->lengths, store->numseqs * sizeof(size_t));
-    store->offsets = realloc(store->offsets, store->numseqs * sizeof(size_t));
-    store->gids = realloc(store->gids, store->numseqs * sizeof(size_t));
+    store->lengths = realloc(store->lengths, store->numseqs * sizeof(uint32_t));
+    store->samples = realloc(store->samples, (store->numseqs / SEQ_STORE_SAMPLE + 1) * sizeof(size_t));
+    store->ranges = realloc(store->ranges, store->numranges * sizeof(gid_range_t));
+
+    /* an empty store still ships (no) checksums, so keep crcs non-NULL */
+    if (store->checksummed)
+        store->crcs = realloc(store->crcs, (store->numseqs? store->numseqs : 1) * sizeof(uint32_t));
 
-    free(mychunk);
     return 0;
 }
 
-int seq_store_get(const seq_store_t store, size_t lid, size_t *gid, char **seq)
+/*
+ * Read [startpos, endpos) of fh. Without an alignment every process reads
+ * exactly its own range. Otherwise the file is cut into contiguous domains
+ * whose boundaries are multiples of cfg.align (the first and last ones being
+ * the first and last needed bytes), each process reads its domain, and the
+ * bytes of records that cross a domain boundary are handed over to the
+ * processes that need them. Returns the malloc'd buffer, which starts at
+ * file position *basepos.
+ */
+static char *read_chunk(MPI_File fh, MPI_Offset startpos, MPI_Offset endpos, MPI_Comm comm, io_config_t cfg, MPI_Offset *basepos)
 {
-    static const char bases[5] = {'A', 'C', 'G', 'T', 'N'};
+    int myrank, nprocs;
+    char *chunk;
 
-    if (!seq) return -1;
+    if (!cfg.align)
+    {
+        chunk = malloc(endpos - startpos);
+        *basepos = startpos;
 
-    size_t len = store.lengths[lid];
-    size_t offset = store.offsets[lid];
+        if (cfg.independent)
+            MPI_CHECK(MPI_File_read_at(fh, startpos, chunk, (int)(endpos - startpos), MPI_CHAR, MPI_STATUS_IGNORE));
+        else
+            MPI_CHECK(MPI_File_read_at_all(fh, startpos, chunk, (int)(endpos - startpos), MPI_CHAR, MPI_STATUS_IGNORE));
 
-    if (gid) *gid = store.gids[lid];
+        return chunk;
+    }
 
-    char *s = realloc(*seq, len+1);
-    if (s) *seq = s;
+    mpi_info(comm, &myrank, &nprocs);
 
-    memset(s, '\0', len+1);
+    /*
+     * needs[2*i..2*i+1] is the range process i needs, doms[2*i..2*i+1] its
+     * domain (empty for processes that need nothing).
+     */
+    MPI_Offset need[2] = {startpos, endpos};
+    MPI_Offset *needs = malloc(2 * nprocs * sizeof(MPI_Offset));
+    MPI_Offset *doms = calloc(2 * nprocs, sizeof(MPI_Offset));
+    MPI_Offset align = (MPI_Offset)cfg.align, first = -1;
+    int last = -1;
 
-    for (size_t i = 0; i < len; ++i)
+    MPI_Allgather(need, 2, MPI_OFFSET, needs, 2, MPI_OFFSET, comm);
+
+    for (int i = 0; i < nprocs; ++i)
     {
-        s[i] = bases[(store.buf[offset + (i/4)] >> ((i%4)<<1))&3];
-    }
+        if (needs[2*i] == needs[2*i+1])
+            continue;
 
-    return len <= INT_MAX? len : INT_MAX;
-}
+        if (first < 0)
+            doms[2*i] = first = needs[2*i];
+        else
+        {
+            MPI_Offset aligned = (needs[2*i] / align) * align;
+            doms[2*i] = aligned > first? aligned : first;
+            doms[2*last+1] = doms[2*i];
+        }
 
-void seq_store_info(const seq_store_t store, char const *fname, commgrid_t const *grid)
-{
-    int myrank = grid->gridrank;
-    char *info;
+        doms[2*i+1] = needs[2*i+1];
+        last = i;
+    }
 
-    int len = asprintf(&info, "myrank=%d\tgridrow=%d\tgridcol=%d\tnumbytes=%lu\tnumseqs=%lu\ttotbases=%lu\n",
-                               myrank, grid->gridrow, grid->gridcol, store.numbytes, store.numseqs, store.totbases);
+    MPI_Offset domstart = doms[2*myrank], domend = doms[2*myrank+1];
 
-    MPI_File fh;
+    *basepos = domstart < startpos? domstart : startpos;
+    MPI_Offset top = domend > endpos? domend : endpos;
 
-    MPI_CHECK(MPI_File_open(grid->grid_world, fname, MPI_MODE_WRONLY|MPI_MODE_CREATE, MPI_INFO_NULL, &fh));
-    MPI_CHECK(MPI_File_write_ordered(fh, info, len, MPI_CHAR, MPI_STATUS_IGNORE));
-    MPI_CHECK(MPI_File_close(&fh));
+    chunk = malloc(top - *basepos);
 
-    free(info);
-}
+    if (cfg.independent)
+        MPI_CHECK(MPI_File_read_at(fh, domstart, chunk + (domstart - *basepos), (int)(domend - domstart), MPI_CHAR, MPI_STATUS_IGNORE));
+    else
+        MPI_CHECK(MPI_File_read_at_all(fh, domstart, chunk + (domstart - *basepos), (int)(domend - domstart), MPI_CHAR, MPI_STATUS_IGNORE));
 
-void seq_store_log(const seq_store_t store, char const *fname_prefix, string_store_t const *names, MPI_Comm comm)
-{
-    size_t numseqs;
-    int myrank;
-    char *log_fname;
-    FILE *f;
+    /*
+     * Hand over boundary bytes: what others need from my domain, and what I
+     * need from theirs.
+     */
+    MPI_Request *reqs = malloc(2 * nprocs * sizeof(MPI_Request));
+    int numreqs = 0;
 
-    mpi_info(comm, &myrank, NULL);
+    for (int i = 0; i < nprocs; ++i)
+    {
+        if (i == myrank) continue;
 
-    numseqs = store.numseqs;
-    asprintf(&log_fname, "%s.rank%d.log", fname_prefix, myrank);
+        MPI_Offset lo = domstart > needs[2*i]? domstart : needs[2*i];
+        MPI_Offset hi = domend < needs[2*i+1]? domend : needs[2*i+1];
 
-    f = fopen(log_fname, "w");
-    free(log_fname);
+        if (lo < hi)
+            MPI_Isend(chunk + (lo - *basepos), (int)(hi - lo), MPI_CHAR, i, 0, comm, &reqs[numreqs++]);
 
-    char *name = names? malloc(sstore_maxlen(*names)+1) : NULL;
+        lo = doms[2*i] > startpos? doms[2*i] : startpos;
+        hi = doms[2*i+1] < endpos? doms[2*i+1] : endpos;
 
-    for (size_t i = 0; i < numseqs; ++i)
-    {
-        size_t gid;
-        char *seq = NULL;
-        seq_store_get(store, i, &gid, &seq);
+        if (lo < hi)
+            MPI_Irecv(chunk + (lo - *basepos), (int)(hi - lo), MPI_CHAR, i, 0, comm, &reqs[numreqs++]);
+    }
 
-        if (name)
-        {
-            sstore_get_string_copy(*names, gid, name);
-            fprintf(f, "%s\t%s\n", name, seq);
-        }
-        else
-        {
-            fprintf(f, "%lu\t%s\n", gid, seq);
-        }
+    MPI_Waitall(numreqs, reqs, MPI_STATUSES_IGNORE);
 
-        free(seq);
-    }
+    free(reqs);
+    free(needs);
+    free(doms);
 
-    if (name) free(name);
+    return chunk;
 }
 
-int seq_store_free(seq_store_t *store)
+int seq_store_read(seq_store_t *store, const char *fname, const fasta_index_t faidx)
 {
     if (!store) return -1;
 
-    free(store->buf);
-    free(store->lengths);
-    free(store->offsets);
-    free(store->gids);
-    *store = (seq_store_t){0};
+    size_t num_records = faidx.num_records;
+    io_config_t cfg = io_config_current();
 
-    return 0;
-}
+    MPI_File fh;
+    MPI_CHECK(MPI_File_open(faidx.grid->grid_world, fname, MPI_MODE_RDONLY, cfg.info, &fh));
 
-static inline void partial_sum(int *displs, int *counts, int n)
-{
-    displs[0] = 0;
+    MPI_Offset filesize, startpos, endpos, basepos;
+    MPI_CHECK(MPI_File_get_size(fh, &filesize));
+
+    records_range(faidx.records, num_records, filesize, &startpos, &endpos);
+
+    char *mychunk = read_chunk(fh, startpos, endpos, faidx.grid->grid_world, cfg, &basepos);
+    MPI_CHECK(MPI_File_close(&fh));
+
+    size_t offset = 0;
+    MPI_Exscan(&num_records, &offset, 1, MPI_SIZE_T, MPI_SUM, faidx.grid->grid_world);
+
+    int err = encode_records(store, mychunk, basepos, faidx.records, num_records, offset, NULL, NULL);
 
-    for (int i = 0; i < n-1; ++i)
-        displs[i+1] = displs[i] + counts[i];
+    free(mychunk);
+    return err;
 }
 
-/* blocking version */
-int seq_store_share(const seq_store_t send_store, seq_store_t *row_store, seq_store_t *col_store, commgrid_t const *grid)
+/*
+ * Read local records [first, last) of an index made by
+ * fasta_index_read_files. Every process opens just the files those records
+ * come from, on its own, and reads the range of each into *chunk (grown with
+ * realloc). records receives the records with positions rewritten to their
+ * position within the chunk.
+ */
+static void read_runs(char const * const *fnames, const fasta_index_t faidx, size_t first, size_t last, fasta_record_t *records, char **chunk)
 {
-    /*
-     * Note: this function currently is inefficient due to the many collective
-     *       MPI calls. At some point it will need to be simplified using derived
-     *       datatypes and perhaps smarter packing/unpacking.
-     */
-
-    if (!row_store || !col_store || !grid)
-        return -1;
+    io_config_t cfg = io_config_current();
+    size_t chunksize = 0;
 
-    /*
-     * Compute row and column reduction on sequence storage's size information,
-     * i.e. number of bytes for the buffer, number of sequences stored, and
-     * the number of total bases.
-     */
-    size_t send_info[3], row_info[3], col_info[3];
+    memcpy(records, faidx.records + first, (last - first) * sizeof(fasta_record_t));
 
-    send_info[0] = send_store.numbytes;
-    send_info[1] = send_store.numseqs;
-    send_info[2] = send_store.totbases;
+    for (int r = 0; r < faidx.numruns; ++r)
+    {
+        size_t lo = faidx.runs[r].first;
+        size_t hi = r+1 < faidx.numruns? faidx.runs[r+1].first : faidx.num_records;
 
-    MPI_Allreduce(send_info, row_info, 3, MPI_SIZE_T, MPI_SUM, grid->row_world);
-    MPI_Allreduce(send_info, col_info, 3, MPI_SIZE_T, MPI_SUM, grid->col_world);
+        lo = lo > first? lo : first;
+        hi = hi < last? hi : last;
 
-    /*
-     * Initialize row and column storage structures with their size information.
-     */
-    *row_store = (seq_store_t){NULL, NULL, NULL, NULL, row_info[0], row_info[1], row_info[2]};
-    *col_store = (seq_store_t){NULL, NULL, NULL, NULL, col_info[0], col_info[1], col_info[2]};
+        if (lo >= hi) continue;
 
-    /*
-     * Allocate memory for row and column sequence storage.
-     */
-    row_store->buf = malloc(row_store->numbytes);
-    row_store->lengths = malloc(row_store->numseqs * sizeof(size_t));
-    row_store->offsets = malloc(row_store->numseqs * sizeof(size_t));
-    row_store->gids = malloc(row_store->numseqs * sizeof(size_t));
+        MPI_File fh;
+        MPI_CHECK(MPI_File_open(MPI_COMM_SELF, fnames[faidx.runs[r].file], MPI_MODE_RDONLY, cfg.info, &fh));
 
-    col_store->buf = malloc(col_store->numbytes);
-    col_store->lengths = malloc(col_store->numseqs * sizeof(size_t));
-    col_store->offsets = malloc(col_store->numseqs * sizeof(size_t));
-    col_store->gids = malloc(col_store->numseqs * sizeof(size_t));
+        MPI_Offset filesize, startpos, endpos;
+        MPI_CHECK(MPI_File_get_size(fh, &filesize));
 
-    int sendcnt = (int)send_store.numseqs;
-    size_t row_offset = send_store.numbytes;
-    size_t col_offset = send_store.numbytes;
+        records_range(records + (lo - first), hi - lo, filesize, &startpos, &endpos);
 
-    MPI_Exscan(MPI_IN_PLACE, &row_offset, 1, MPI_SIZE_T, MPI_SUM, grid->row_world);
-    if (grid->gridcol == 0) row_offset = 0;
+        *chunk = realloc(*chunk, chunksize + (endpos - startpos));
 
-    MPI_Exscan(MPI_IN_PLACE, &col_offset, 1, MPI_SIZE_T, MPI_SUM, grid->col_world);
-    if (grid->gridrow == 0) col_offset = 0;
+        MPI_CHECK(MPI_File_read_at(fh, startpos, *chunk + chunksize, (int)(endpos - startpos), MPI_CHAR, MPI_STATUS_IGNORE));
+        MPI_CHECK(MPI_File_close(&fh));
 
-    size_t *row_offsets = malloc(sendcnt * sizeof(size_t));
-    size_t *col_offsets = malloc(sendcnt * sizeof(size_t));
+        /* positions within the concatenated chunk */
+        for (size_t i = lo - first; i < hi - first; ++i)
+            records[i].pos = chunksize + (records[i].pos - startpos);
 
-    for (int i = 0; i < sendcnt; ++i)
-    {
-        row_offsets[i] = send_store.offsets[i] + row_offset;
-        col_offsets[i] = send_store.offsets[i] + col_offset;
+        chunksize += endpos - startpos;
     }
+}
+
+/*
+ * seq_store_read for an index made by fasta_index_read_files, fnames being
+ * the FASTA files in the same order.
+ */
+int seq_store_read_files(seq_store_t *store, char const * const *fnames, const fasta_index_t faidx)
+{
+    if (!store || faidx.numfiles < 1) return -1;
 
-    int *recvcnts = malloc(grid->dims * sizeof(int));
-    int *displs = malloc(grid->dims * sizeof(int));
+    size_t num_records = faidx.num_records;
+
+    fasta_record_t *records = malloc(num_records * sizeof(fasta_record_t));
+    char *chunk = NULL;
 
-    recvcnts[grid->gridcol] = sendcnt;
-    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, grid->row_world);
-    partial_sum(displs, recvcnts, grid->dims);
+    read_runs(fnames, faidx, 0, num_records, records, &chunk);
 
-    MPI_Allgatherv(send_store.lengths, sendcnt, MPI_SIZE_T, row_store->lengths, recvcnts, displs, MPI_SIZE_T, grid->row_world);
-    MPI_Allgatherv(send_store.gids,    sendcnt, MPI_SIZE_T, row_store->gids,    recvcnts, displs, MPI_SIZE_T, grid->row_world);
-    MPI_Allgatherv(row_offsets,        sendcnt, MPI_SIZE_T, row_store->offsets, recvcnts, displs, MPI_SIZE_T, grid->row_world);
+    size_t offset = 0;
+    MPI_Exscan(&num_records, &offset, 1, MPI_SIZE_T, MPI_SUM, faidx.grid->grid_world);
+    if (!faidx.grid->gridrank) offset = 0;
 
-    recvcnts[grid->gridrow] = sendcnt;
-    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, grid->col_world);
-    partial_sum(displs, recvcnts, grid->dims);
+    int err = encode_records(store, chunk, 0, records, num_records, offset, NULL, NULL);
 
-    MPI_Allgatherv(send_store.lengths, sendcnt, MPI_SIZE_T, col_store->lengths, recvcnts, displs, MPI_SIZE_T, grid->col_world);
-    MPI_Allgatherv(send_store.gids,    sendcnt, MPI_SIZE_T, col_store->gids,    recvcnts, displs, MPI_SIZE_T, grid->col_world);
-    MPI_Allgatherv(col_offsets,        sendcnt, MPI_SIZE_T, col_store->offsets, recvcnts, displs, MPI_SIZE_T, grid->col_world);
+    free(chunk);
+    free(records);
+    return err;
+}
 
-    free(row_offsets);
-    free(col_offsets);
+static int size_t_cmp(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return x < y? -1 : x > y? 1 : 0;
+}
 
-    sendcnt = (int)send_store.numbytes;
+/*
+ * seq_store_read with filters. Length and whitelist filters are applied to
+ * the FASTA index records before any I/O, and only the byte ranges of runs
+ * of kept records are read (through an hindexed file view). Content filters
+ * are applied while encoding. Kept sequences get dense global ids, and if
+ * origids is given it receives a malloc'd array mapping each local id to the
+ * sequence's global id in the unfiltered FASTA index.
+ */
+int seq_store_read_filtered(seq_store_t *store, char const *fname, const fasta_index_t faidx, seq_filter_t const *filter, size_t **origids)
+{
+    if (!store) return -1;
+
+    commgrid_t const *grid = faidx.grid;
+    size_t num_records = faidx.num_records;
 
-    recvcnts[grid->gridcol] = sendcnt;
-    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, grid->row_world);
-    partial_sum(displs, recvcnts, grid->dims);
+    size_t origoffset = 0;
+    MPI_Exscan(&num_records, &origoffset, 1, MPI_SIZE_T, MPI_SUM, grid->grid_world);
+    if (!grid->gridrank) origoffset = 0;
 
-    MPI_Allgatherv(send_store.buf, sendcnt, MPI_UINT8_T, row_store->buf, recvcnts, displs, MPI_UINT8_T, grid->row_world);
+    /*
+     * Metadata filters.
+     */
+    fasta_record_t *records = malloc(num_records * sizeof(fasta_record_t));
+    size_t *recids = malloc(num_records * sizeof(size_t));
+    size_t numkept = 0;
+
+    for (size_t i = 0; i < num_records; ++i)
+    {
+        fasta_record_t const *record = faidx.records + i;
+        size_t gid = origoffset + i;
 
-    recvcnts[grid->gridrow] = sendcnt;
-    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, grid->col_world);
-    partial_sum(displs, recvcnts, grid->dims);
+        if (filter)
+        {
+            if (record->len < filter->min_len || (filter->max_len && record->len > filter->max_len))
+                continue;
 
-    MPI_Allgatherv(send_store.buf, sendcnt, MPI_UINT8_T, col_store->buf, recvcnts, displs, MPI_UINT8_T, grid->col_world);
+            if (filter->whitelist && !bsearch(&gid, filter->whitelist, filter->whitelist_len, sizeof(size_t), size_t_cmp))
+                continue;
+        }
 
-    free(recvcnts);
-    free(displs);
+        records[numkept] = *record;
+        recids[numkept++] = gid;
+    }
 
-    return 0;
-}
+    io_config_t cfg = io_config_current();
 
+    MPI_File fh;
+    MPI_CHECK(MPI_File_open(grid->grid_world, fname, MPI_MODE_RDONLY, cfg.info, &fh));
 
+    MPI_Offset filesize, startpos, endpos;
+    MPI_CHECK(MPI_File_get_size(fh, &filesize));
+
+    /*
+     * One file block per run of consecutive kept records. Record positions
+     * are rewritten to their position within the concatenated blocks.
+     */
+    int numblocks = 0;
+    int *blocklens = malloc(numkept * sizeof(int));
+    MPI_Aint *blockdispls = malloc(numkept * sizeof(MPI_Aint));
+    size_t chunksize = 0, blockpos = 0;
+
+    for (size_t i = 0; i < numkept; ++i)
+    {
+        records_range(records + i, 1, filesize, &startpos, &endpos);
+
+        if (i == 0 || recids[i] != recids[i-1] + 1)
+        {
+            blockpos = chunksize;
+            blockdispls[numblocks] = startpos;
+            blocklens[numblocks++] = 0;
+        }
+
+        records[i].pos = blockpos + (startpos - blockdispls[numblocks-1]);
+        chunksize = blockpos + (endpos - blockdispls[numblocks-1]);
+        blocklens[numblocks-1] = endpos - blockdispls[numblocks-1];
+    }
+
+    MPI_Datatype filetype;
+    MPI_Type_create_hindexed(numblocks, blocklens, blockdispls, MPI_CHAR, &filetype);
+    MPI_Type_commit(&filetype);
+
+    char *chunk = malloc(chunksize);
+
+    MPI_CHECK(MPI_File_set_view(fh, 0, MPI_CHAR, filetype, "native", cfg.info));
+
+    if (cfg.independent)
+        MPI_CHECK(MPI_File_read_at(fh, 0, chunk, (int)chunksize, MPI_CHAR, MPI_STATUS_IGNORE));
+    else
+        MPI_CHECK(MPI_File_read_at_all(fh, 0, chunk, (int)chunksize, MPI_CHAR, MPI_STATUS_IGNORE));
+    MPI_CHECK(MPI_File_close(&fh));
+
+    MPI_Type_free(&filetype);
+    free(blocklens);
+    free(blockdispls);
+
+    /*
+     * Content filters, then dense renumbering of the survivors.
+     */
+    size_t *kept = malloc(numkept * sizeof(size_t));
+    int err = encode_records(store, chunk, 0, records, numkept, 0, filter, kept);
+
+    size_t gidoffset = 0;
+    MPI_Exscan(&store->numseqs, &gidoffset, 1, MPI_SIZE_T, MPI_SUM, grid->grid_world);
+    if (!grid->gridrank) gidoffset = 0;
+
+    for (size_t i = 0; i < store->numranges; ++i)
+        store->ranges[i].gid += gidoffset;
+
+    seq_store_index_gids(store);
+
+    if (origids)
+    {
+        *origids = malloc(store->numseqs * sizeof(size_t));
+
+        for (size_t i = 0; i < store->numseqs; ++i)
+            (*origids)[i] = recids[kept[i]];
+    }
+
+    free(kept);
+    free(chunk);
+    free(records);
+    free(recids);
+
+    return err;
+}
+
+/*
+ * FASTA bytes of record i: up to the next record if that one, below end,
+ * comes from the same file (so the header line is included), otherwise the
+ * bases plus one newline per line.
+ */
+static size_t record_bytes(fasta_record_t const *records, size_t i, size_t end)
+{
+    if (i+1 < end && records[i+1].pos > records[i].pos)
+        return records[i+1].pos - records[i].pos;
+
+    return records[i].len + records[i].len / records[i].bases + 1;
+}
+
+/*
+ * Cut the local records of faidx into batches for seq_store_stream. Record i
+ * costs its FASTA bytes twice (two chunk buffers) plus its packed bytes, and
+ * the row and column stores of a batch hold the packed bytes of the peers'
+ * batches. Every rank cuts its records where its cumulative cost crosses
+ * b/numbatches of its total. A batch then costs at most its share of the
+ * rank's total cost, plus one record (its own and in the row and column
+ * stores of peers). numbatches, the same on every rank, is the smallest
+ * count for which that fits in membudget bytes (membudget == 0 means a
+ * single batch). Batch b is records [(*firsts)[b], (*firsts)[b+1]).
+ */
+static int plan_batches(const fasta_index_t faidx, size_t membudget, size_t **firsts)
+{
+    commgrid_t const *grid = faidx.grid;
+    size_t num_records = faidx.num_records;
+    fasta_record_t const *records = faidx.records;
+
+    size_t *cumcost = malloc((num_records + 1) * sizeof(size_t));
+    size_t packed = 0, rowpacked, colpacked, maxcost = 0;
+    int run = 0;
+
+    cumcost[0] = 0;
+
+    for (size_t i = 0; i < num_records; ++i)
+    {
+        while (run+1 < faidx.numruns && faidx.runs[run+1].first <= i)
+            run++;
+
+        size_t end = run+1 < faidx.numruns? faidx.runs[run+1].first : num_records;
+        size_t p = (records[i].len + 3) / 4 + sizeof(uint32_t);
+        size_t cost = 2*record_bytes(records, i, end) + p;
+
+        cumcost[i+1] = cumcost[i] + cost;
+        packed += p;
+        maxcost = maxcost > cost + 2*p? maxcost : cost + 2*p;
+    }
+
+    MPI_Allreduce(&packed, &rowpacked, 1, MPI_SIZE_T, MPI_SUM, grid->row_world);
+    MPI_Allreduce(&packed, &colpacked, 1, MPI_SIZE_T, MPI_SUM, grid->col_world);
+
+    size_t info[3] = {cumcost[num_records] + rowpacked + colpacked, maxcost, num_records};
+
+    MPI_Allreduce(MPI_IN_PLACE, info, 3, MPI_SIZE_T, MPI_MAX, grid->grid_world);
+
+    /* a budget smaller than one record's cost gets one record per batch */
+    size_t numbatches = !membudget? 1 : membudget > info[1]? (info[0] + membudget - info[1] - 1) / (membudget - info[1]) : info[2];
+
+    numbatches = numbatches < info[2]? numbatches : info[2];
+    numbatches = numbatches > 0? numbatches : 1;
+
+    *firsts = malloc((numbatches + 1) * sizeof(size_t));
+    (*firsts)[0] = 0;
+
+    size_t i = 0;
+
+    for (size_t b = 1; b < numbatches; ++b)
+    {
+        size_t target = (size_t)((double)cumcost[num_records] * b / numbatches);
+
+        while (i < num_records && cumcost[i+1] <= target)
+            i++;
+
+        (*firsts)[b] = i;
+    }
+
+    (*firsts)[numbatches] = num_records;
+
+    free(cumcost);
+    return (int)numbatches;
+}
+
+/*
+ * Encode, share and consume one batch of seq_store_stream. Returns nonzero,
+ * the same on every rank, if any rank failed.
+ */
+static int stream_batch(int b, int numbatches, char const *chunk, MPI_Offset basepos, fasta_record_t const *records, size_t n, size_t gidoffset, commgrid_t const *grid, seq_store_batch_fn fn, void *arg)
+{
+    seq_store_t store, row_store, col_store;
+
+    int err = encode_records(&store, chunk, basepos, records, n, gidoffset, NULL, NULL);
+
+    /* the share is collective, so either every rank runs it or none does */
+    MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_LOR, grid->grid_world);
+
+    if (!err)
+    {
+        err = seq_store_share_shared(&store, &row_store, &col_store, grid);
+        err = fn(b, numbatches, &store, &row_store, &col_store, arg) || err;
+        seq_store_free(&row_store);
+        seq_store_free(&col_store);
+    }
+
+    seq_store_free(&store);
+
+    MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MAX, grid->grid_world);
+
+    return err;
+}
+
+/*
+ * Out-of-core pipeline: the local FASTA index records are split into
+ * batches that fit in membudget bytes (see plan_batches). For each batch,
+ * the local store is encoded and shared and fn is called with the three
+ * stores, which are freed when fn returns. The FASTA read of batch b+1 is in
+ * flight while batch b is being encoded, shared and consumed. If fn returns
+ * nonzero on any rank, all ranks stop after that batch and seq_store_stream
+ * returns -1.
+ */
+int seq_store_stream(char const *fname, const fasta_index_t faidx, size_t membudget, seq_store_batch_fn fn, void *arg)
+{
+    if (!fn) return -1;
+
+    commgrid_t const *grid = faidx.grid;
+    size_t num_records = faidx.num_records;
+    fasta_record_t const *records = faidx.records;
+    io_config_t cfg = io_config_current();
+
+    MPI_File fh;
+    MPI_CHECK(MPI_File_open(grid->grid_world, fname, MPI_MODE_RDONLY, cfg.info, &fh));
+
+    MPI_Offset filesize, startpos, endpos;
+    MPI_CHECK(MPI_File_get_size(fh, &filesize));
+
+    size_t *firsts;
+    int numbatches = plan_batches(faidx, membudget, &firsts);
+
+    size_t gidoffset = 0;
+    MPI_Exscan(&num_records, &gidoffset, 1, MPI_SIZE_T, MPI_SUM, grid->grid_world);
+    if (!grid->gridrank) gidoffset = 0;
+
+    /*
+     * Two chunk buffers, sized for the largest batch, are reused by all batches.
+     */
+    MPI_Offset *starts = malloc(numbatches * sizeof(MPI_Offset));
+    int *chunksizes = malloc(numbatches * sizeof(int));
+    int maxchunksize = 0;
+
+    for (int b = 0; b < numbatches; ++b)
+    {
+        records_range(records + firsts[b], firsts[b+1] - firsts[b], filesize, &startpos, &endpos);
+        starts[b] = startpos;
+        chunksizes[b] = endpos - startpos;
+        maxchunksize = maxchunksize > chunksizes[b]? maxchunksize : chunksizes[b];
+    }
+
+    char *chunks[2];
+    chunks[0] = malloc(maxchunksize);
+    chunks[1] = malloc(maxchunksize);
+
+    MPI_Request req;
+
+    if (cfg.independent)
+        MPI_CHECK(MPI_File_iread_at(fh, starts[0], chunks[0], chunksizes[0], MPI_CHAR, &req));
+    else
+        MPI_CHECK(MPI_File_iread_at_all(fh, starts[0], chunks[0], chunksizes[0], MPI_CHAR, &req));
+
+    int err = 0;
+
+    for (int b = 0; b < numbatches && !err; ++b)
+    {
+        MPI_Wait(&req, MPI_STATUS_IGNORE);
+
+        if (b+1 < numbatches && cfg.independent)
+            MPI_CHECK(MPI_File_iread_at(fh, starts[b+1], chunks[(b+1)%2], chunksizes[b+1], MPI_CHAR, &req));
+        else if (b+1 < numbatches)
+            MPI_CHECK(MPI_File_iread_at_all(fh, starts[b+1], chunks[(b+1)%2], chunksizes[b+1], MPI_CHAR, &req));
+
+        err = stream_batch(b, numbatches, chunks[b%2], starts[b], records + firsts[b], firsts[b+1] - firsts[b], gidoffset + firsts[b], grid, fn, arg);
+
+        if (err && b+1 < numbatches)
+            MPI_Wait(&req, MPI_STATUS_IGNORE);
+    }
+
+    MPI_CHECK(MPI_File_close(&fh));
+
+    free(chunks[0]);
+    free(chunks[1]);
+    free(starts);
+    free(chunksizes);
+    free(firsts);
+
+    return err? -1 : 0;
+}
+
+/*
+ * seq_store_stream for an index made by fasta_index_read_files, fnames being
+ * the FASTA files in the same order. Each batch is read with independent
+ * per-file reads (see read_runs), so reads are not overlapped with the
+ * previous batch.
+ */
+int seq_store_stream_files(char const * const *fnames, const fasta_index_t faidx, size_t membudget, seq_store_batch_fn fn, void *arg)
+{
+    if (!fn || faidx.numfiles < 1) return -1;
+
+    commgrid_t const *grid = faidx.grid;
+    size_t num_records = faidx.num_records;
+
+    size_t *firsts;
+    int numbatches = plan_batches(faidx, membudget, &firsts);
+
+    size_t gidoffset = 0;
+    MPI_Exscan(&num_records, &gidoffset, 1, MPI_SIZE_T, MPI_SUM, grid->grid_world);
+    if (!grid->gridrank) gidoffset = 0;
+
+    size_t maxbatch = 0;
+
+    for (int b = 0; b < numbatches; ++b)
+        maxbatch = maxbatch > firsts[b+1] - firsts[b]? maxbatch : firsts[b+1] - firsts[b];
+
+    fasta_record_t *records = malloc((maxbatch? maxbatch : 1) * sizeof(fasta_record_t));
+    char *chunk = NULL;
+    int err = 0;
+
+    for (int b = 0; b < numbatches && !err; ++b)
+    {
+        read_runs(fnames, faidx, firsts[b], firsts[b+1], records, &chunk);
+        err = stream_batch(b, numbatches, chunk, 0, records, firsts[b+1] - firsts[b], gidoffset + firsts[b], grid, fn, arg);
+    }
+
+    free(chunk);
+    free(records);
+    free(firsts);
+
+    return err? -1 : 0;
+}
+
+int seq_store_get(const seq_store_t store, size_t lid, size_t *gid, char **seq)
+{
+    static const char bases[5] = {'A', 'C', 'G', 'T', 'N'};
+
+    if (!seq) return -1;
+
+    size_t len = seq_store_length(store, lid);
+    size_t offset = seq_store_offset(store, lid);
+
+    if (gid) *gid = seq_store_gid(store, lid);
+
+    char *s = realloc(*seq, len+1);
+    if (s) *seq = s;
+
+    memset(s, '\0', len+1);
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        s[i] = bases[(store.buf[offset + (i/4)] >> ((i%4)<<1))&3];
+    }
+
+    return len <= INT_MAX? len : INT_MAX;
+}
+
+/*
+ * Reverse complement of the four bases packed in a byte.
+ */
+static inline uint8_t revcomp_byte(uint8_t b)
+{
+    b = (uint8_t)~b;
+    b = (uint8_t)((b >> 4) | (b << 4));
+    return (uint8_t)(((b >> 2) & 0x33) | ((b & 0x33) << 2));
+}
+
+/*
+ * Same as revcomp_byte on all eight bytes of a word, also reversing their order.
+ */
+static inline uint64_t revcomp_word(uint64_t w)
+{
+    w = __builtin_bswap64(~w);
+    w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+}
+
+/*
+ * Shift a packed buffer of numbytes bytes down by shift bases (0..3) in place.
+ */
+static void shift_bases(uint8_t *buf, size_t numbytes, int shift)
+{
+    if (!shift || !numbytes) return;
+
+    int s = 2*shift;
+
+    for (size_t i = 0; i < numbytes-1; ++i)
+        buf[i] = (uint8_t)((buf[i] >> s) | (buf[i+1] << (8-s)));
+
+    buf[numbytes-1] >>= s;
+}
+
+/*
+ * Zero the unused high bits of the last byte of a packed sequence of len bases.
+ */
+static inline void mask_tail(uint8_t *buf, size_t len)
+{
+    if (len % 4)
+        buf[len/4] &= (uint8_t)((1 << (2*(len%4))) - 1);
+}
+
+/*
+ * Reverse complement a packed sequence of len bases in place.
+ */
+void packed_revcomp(uint8_t *buf, size_t len)
+{
+    size_t numbytes = (len + 3) / 4;
+    size_t lo = 0, hi = numbytes;
+
+    /*
+     * Reverse and complement whole bytes, eight at a time from both ends.
+     */
+    while (hi - lo >= 16)
+    {
+        uint64_t a, b;
+        memcpy(&a, buf + lo, 8);
+        memcpy(&b, buf + hi - 8, 8);
+        a = revcomp_word(a);
+        b = revcomp_word(b);
+        memcpy(buf + lo, &b, 8);
+        memcpy(buf + hi - 8, &a, 8);
+        lo += 8;
+        hi -= 8;
+    }
+
+    while (hi - lo >= 2)
+    {
+        uint8_t a = buf[lo];
+        buf[lo++] = revcomp_byte(buf[--hi]);
+        buf[hi] = revcomp_byte(a);
+    }
+
+    if (hi - lo == 1)
+        buf[lo] = revcomp_byte(buf[lo]);
+
+    /*
+     * The padding bases of the last byte are now at the front; drop them.
+     */
+    shift_bases(buf, numbytes, (int)(4*numbytes - len));
+    mask_tail(buf, len);
+}
+
+/*
+ * Copy bases [start, end) of sequence lid into dest, packed from bit 0 of
+ * dest[0]. dest must hold (end-start+3)/4 bytes. Returns that byte count.
+ */
+size_t seq_store_extract(const seq_store_t store, size_t lid, size_t start, size_t end, uint8_t *dest)
+{
+    assert(start <= end && end <= seq_store_length(store, lid));
+
+    size_t len = end - start;
+    size_t numbytes = (len + 3) / 4;
+    const uint8_t *src = store.buf + seq_store_offset(store, lid) + start/4;
+    int s = 2*(start%4);
+
+    if (!numbytes) return 0;
+
+    if (!s)
+    {
+        memcpy(dest, src, numbytes);
+    }
+    else
+    {
+        /* the last source byte needed is (start%4 + len - 1)/4 */
+        size_t srcbytes = (start%4 + len + 3) / 4;
+
+        for (size_t i = 0; i < numbytes; ++i)
+            dest[i] = (uint8_t)((src[i] >> s) | (i+1 < srcbytes? src[i+1] << (8-s) : 0));
+    }
+
+    mask_tail(dest, len);
+    return numbytes;
+}
+
+/*
+ * Like seq_store_extract, but dest receives the reverse complement of [start, end).
+ */
+size_t seq_store_extract_revcomp(const seq_store_t store, size_t lid, size_t start, size_t end, uint8_t *dest)
+{
+    size_t numbytes = seq_store_extract(store, lid, start, end, dest);
+    packed_revcomp(dest, end - start);
+    return numbytes;
+}
+
+/*
+ * Decode bases [start, end) of sequence lid (or their reverse complement)
+ * into dest, which must hold end-start+1 chars. Returns end-start.
+ */
+size_t seq_store_decode(const seq_store_t store, size_t lid, size_t start, size_t end, int revcomp, char *dest)
+{
+    static const char bases[4] = {'A', 'C', 'G', 'T'};
+
+    assert(start <= end && end <= seq_store_length(store, lid));
+
+    const uint8_t *src = store.buf + seq_store_offset(store, lid);
+    size_t len = end - start;
+
+    if (revcomp)
+    {
+        for (size_t i = start; i < end; ++i)
+            dest[end-1-i] = bases[3 ^ ((src[i/4] >> ((i%4)<<1))&3)];
+    }
+    else
+    {
+        for (size_t i = start; i < end; ++i)
+            dest[i-start] = bases[(src[i/4] >> ((i%4)<<1))&3];
+    }
+
+    dest[len] = '\0';
+    return len;
+}
+
+int seq_store_get_revcomp(const seq_store_t store, size_t lid, size_t *gid, char **seq)
+{
+    if (!seq) return -1;
+
+    size_t len = seq_store_length(store, lid);
+
+    if (gid) *gid = seq_store_gid(store, lid);
+
+    char *s = realloc(*seq, len+1);
+    if (s) *seq = s;
+
+    seq_store_decode(store, lid, 0, len, 1, s);
+
+    return len <= INT_MAX? len : INT_MAX;
+}
+
+void seq_store_info(const seq_store_t store, char const *fname, commgrid_t const *grid)
+{
+    int myrank = grid->gridrank;
+    char *info;
+
+    int len = asprintf(&info, "myrank=%d\tgridrow=%d\tgridcol=%d\tnumbytes=%lu\tnumseqs=%lu\ttotbases=%lu\n",
+                               myrank, grid->gridrow, grid->gridcol, store.numbytes, store.numseqs, store.totbases);
+
+    MPI_File fh;
+
+    MPI_CHECK(MPI_File_open(grid->grid_world, fname, MPI_MODE_WRONLY|MPI_MODE_CREATE, MPI_INFO_NULL, &fh));
+    MPI_CHECK(MPI_File_write_ordered(fh, info, len, MPI_CHAR, MPI_STATUS_IGNORE));
+    MPI_CHECK(MPI_File_close(&fh));
+
+    free(info);
+}
+
+void seq_store_log(const seq_store_t store, char const *fname_prefix, string_store_t const *names, MPI_Comm comm)
+{
+    size_t numseqs;
+    int myrank;
+    char *log_fname;
+    FILE *f;
+
+    mpi_info(comm, &myrank, NULL);
+
+    numseqs = store.numseqs;
+    asprintf(&log_fname, "%s.rank%d.log", fname_prefix, myrank);
+
+    f = fopen(log_fname, "w");
+    free(log_fname);
+
+    char *name = names? malloc(sstore_maxlen(*names)+1) : NULL;
+
+    for (size_t i = 0; i < numseqs; ++i)
+    {
+        size_t gid;
+        char *seq = NULL;
+        seq_store_get(store, i, &gid, &seq);
+
+        if (name)
+        {
+            sstore_get_string_copy(*names, gid, name);
+            fprintf(f, "%s\t%s\n", name, seq);
+        }
+        else
+        {
+            fprintf(f, "%lu\t%s\n", gid, seq);
+        }
+
+        free(seq);
+    }
+
+    if (name) free(name);
+    fclose(f);
+}
+
+static void gid_index_free(seq_gid_index_t *index)
+{
+    if (!index) return;
+
+    free(index->runs);
+    free(index->buckets);
+    free(index->slots);
+    free(index);
+}
+
+static int gid_run_cmp(const void *a, const void *b)
+{
+    size_t x = ((const gid_run_t *)a)->gid, y = ((const gid_run_t *)b)->gid;
+    return x < y? -1 : x > y? 1 : 0;
+}
+
+/*
+ * Build (or rebuild) the gid index of store. A range table is used while the
+ * store has at most one run per SEQ_GID_RUNLEN sequences, and the directory
+ * gets about two buckets per run, so a lookup reads one bucket and, on
+ * average, about one run.
+ */
+#define SEQ_GID_RUNLEN 8
+#define SEQ_GID_MINRUNS 64
+
+int seq_store_index_gids(seq_store_t *store)
+{
+    if (!store) return -1;
+
+    gid_index_free(store->gidindex);
+
+    seq_gid_index_t *index = calloc(1, sizeof(seq_gid_index_t));
+    index->runs = malloc(store->numranges * sizeof(gid_run_t));
+
+    for (size_t r = 0; r < store->numranges; ++r)
+    {
+        size_t end = r+1 < store->numranges? store->ranges[r+1].lid : store->numseqs;
+
+        if (end > store->ranges[r].lid)
+            index->runs[index->numruns++] = (gid_run_t){store->ranges[r].gid, store->ranges[r].lid, end - store->ranges[r].lid};
+    }
+
+    qsort(index->runs, index->numruns, sizeof(gid_run_t), gid_run_cmp);
+
+    if (index->numruns <= SEQ_GID_MINRUNS || index->numruns * SEQ_GID_RUNLEN <= store->numseqs)
+    {
+        /*
+         * Range table.
+         */
+        size_t target = up_size_t(2 * index->numruns + 1);
+        size_t span = index->numruns? index->runs[index->numruns-1].gid + index->runs[index->numruns-1].len - index->runs[0].gid : 1;
+
+        index->mingid = index->numruns? index->runs[0].gid : 0;
+
+        while (((span - 1) >> index->shift) + 1 > target)
+            index->shift++;
+
+        index->numbuckets = ((span - 1) >> index->shift) + 1;
+        index->buckets = malloc(index->numbuckets * sizeof(size_t));
+
+        for (size_t b = 0, r = 0; b < index->numbuckets; ++b)
+        {
+            size_t first = index->mingid + (b << index->shift);
+
+            while (r+1 < index->numruns && index->runs[r+1].gid <= first)
+                r++;
+
+            index->buckets[b] = r;
+        }
+    }
+    else
+    {
+        /*
+         * Hash table with at least twice as many slots as sequences.
+         */
+        size_t numslots = up_size_t(2 * store->numseqs);
+
+        index->mask = numslots - 1;
+        index->slots = malloc(numslots * sizeof(gid_slot_t));
+
+        for (size_t i = 0; i < numslots; ++i)
+            index->slots[i] = (gid_slot_t){SEQ_STORE_NOTFOUND, SEQ_STORE_NOTFOUND};
+
+        for (size_t r = 0; r < index->numruns; ++r)
+        {
+            for (size_t j = 0; j < index->runs[r].len; ++j)
+            {
+                size_t gid = index->runs[r].gid + j, i = seq_gid_hash(gid) & index->mask;
+
+                while (index->slots[i].lid != SEQ_STORE_NOTFOUND && index->slots[i].gid != gid)
+                    i = (i+1) & index->mask;
+
+                index->slots[i] = (gid_slot_t){gid, index->runs[r].lid + j};
+            }
+        }
+
+        free(index->runs);
+        index->runs = NULL;
+    }
+
+    store->gidindex = index;
+    return 0;
+}
+
+/*
+ * Batched seq_store_lid. Hash lookups hash a block of gids at a time and
+ * prefetch their slots before probing, so that the cache misses of the block
+ * overlap.
+ */
+#define SEQ_GID_LANES 8
+
+void seq_store_lids(const seq_store_t store, size_t const *gids, size_t n, size_t *lids)
+{
+    seq_gid_index_t const *index = store.gidindex;
+
+    assert(index);
+
+    if (!index->slots)
+    {
+        for (size_t i = 0; i < n; ++i)
+            lids[i] = seq_store_lid(store, gids[i]);
+
+        return;
+    }
+
+    size_t i = 0;
+
+    for (; i + SEQ_GID_LANES <= n; i += SEQ_GID_LANES)
+    {
+        size_t pos[SEQ_GID_LANES];
+
+        for (int l = 0; l < SEQ_GID_LANES; ++l)
+            pos[l] = seq_gid_hash(gids[i+l]) & index->mask;
+
+        for (int l = 0; l < SEQ_GID_LANES; ++l)
+            __builtin_prefetch(&index->slots[pos[l]]);
+
+        for (int l = 0; l < SEQ_GID_LANES; ++l)
+        {
+            size_t p = pos[l];
+
+            while (index->slots[p].gid != gids[i+l] && index->slots[p].lid != SEQ_STORE_NOTFOUND)
+                p = (p+1) & index->mask;
+
+            lids[i+l] = index->slots[p].lid;
+        }
+    }
+
+    for (; i < n; ++i)
+        lids[i] = seq_store_lid(store, gids[i]);
+}
+
+int seq_store_free(seq_store_t *store)
+{
+    if (!store) return -1;
+
+    gid_index_free(store->gidindex);
+    buf_free(store->buf, store->numbytes, store->bufkind);
+    free(store->lengths);
+    free(store->samples);
+    free(store->ranges);
+    free(store->crcs);
+    *store = (seq_store_t){0};
+
+    return 0;
+}
+
+/*
+ * Allgatherv of the packed buffer segments as compressed blobs, each decoded
+ * straight into its place in buf. The caller's own segment must already be
+ * in place. Returns -1, having decided the same on every process of comm, if
+ * the segments should be exchanged uncompressed instead.
+ */
+static int wire_allgather(uint8_t const *sendbuf, int sendcnt, uint8_t *buf, int const *recvcnts, int const *displs, MPI_Comm comm)
+{
+    int myrank, nprocs;
+    mpi_info(comm, &myrank, &nprocs);
+
+    if (wiremode == SEQ_WIRE_OFF || nprocs == 1)
+        return -1;
+
+    if (wiremode == SEQ_WIRE_AUTO)
+    {
+        double ratio, ctime, dtime;
+        wire_probe(sendbuf, sendcnt, &ratio, &ctime, &dtime);
+
+        /*
+         * Every process receives about all bytes, and the slowest compressor
+         * and decompressor set the pace.
+         */
+        double sums[2] = {sendcnt, sendcnt * ratio}, gsums[2];
+        double maxs[2] = {sendcnt * ctime, dtime}, gmaxs[2];
+
+        MPI_Allreduce(sums, gsums, 2, MPI_DOUBLE, MPI_SUM, comm);
+        MPI_Allreduce(maxs, gmaxs, 2, MPI_DOUBLE, MPI_MAX, comm);
+
+        double plain = gsums[0] / wirebw;
+        double compressed = gmaxs[0] + gsums[1] / wirebw + gsums[0] * gmaxs[1];
+
+        if (compressed >= plain)
+        {
+            wireoff++;
+            return -1;
+        }
+    }
+
+    uint8_t *blob = malloc(wire_bound(sendcnt));
+    int blobsize = (int)wire_compress(sendbuf, sendcnt, blob);
+
+    int *blobcnts = malloc(nprocs * sizeof(int));
+    int *blobdispls = malloc(nprocs * sizeof(int));
+
+    blobcnts[myrank] = blobsize;
+    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, blobcnts, 1, MPI_INT, comm);
+    partial_sum(blobdispls, blobcnts, nprocs);
+
+    uint8_t *blobs = malloc((size_t)blobdispls[nprocs-1] + blobcnts[nprocs-1]);
+
+    MPI_Allgatherv(blob, blobsize, MPI_UINT8_T, blobs, blobcnts, blobdispls, MPI_UINT8_T, comm);
+
+    for (int i = 0; i < nprocs; ++i)
+    {
+        if (i == myrank) continue;
+
+        if (wire_decompress(blobs + blobdispls[i], blobcnts[i], buf + displs[i], recvcnts[i]))
+        {
+            fprintf(stderr, "seq_store_error: corrupt compressed segment from rank %d\n", i);
+            MPI_Abort(comm, -1);
+        }
+    }
+
+    wireraw += sendcnt;
+    wiresent += blobsize;
+    wireon++;
+
+    free(blob);
+    free(blobs);
+    free(blobcnts);
+    free(blobdispls);
+
+    return 0;
+}
+
+/*
+ * Check every sequence of a received store against the checksum its owner
+ * computed. Every SEQ_CRC_TESTBYTES, the pending requests are tested so that
+ * exchanges still in flight keep progressing. Returns the number of
+ * mismatches, the first few of which are reported on stderr.
+ */
+static size_t verify_crcs(const seq_store_t store, MPI_Request *pending, int numpending)
+{
+    size_t offset = 0, tested = 0, bad = 0;
+    double t = MPI_Wtime();
+    int flag;
+
+    for (size_t i = 0; i < store.numseqs; ++i)
+    {
+        size_t n = (store.lengths[i] + 3) / 4;
+
+        if (crc32c(0, store.buf + offset, n) != store.crcs[i])
+        {
+            if (bad++ < SEQ_CRC_MAXREPORT)
+                fprintf(stderr, "seq_store_error: CRC32C mismatch for sequence %lu (global id %lu)\n", i, seq_store_gid(store, i));
+        }
+
+        offset += n;
+
+        if (numpending && offset - tested >= SEQ_CRC_TESTBYTES)
+        {
+            MPI_Testall(numpending, pending, &flag, MPI_STATUSES_IGNORE);
+            tested = offset;
+        }
+    }
+
+    crcseqs += store.numseqs;
+    crcbytes += offset;
+    crcbad += bad;
+    crctime += MPI_Wtime() - t;
+
+    return bad;
+}
+
+/*
+ * Buffer exchange of allgather_store still in flight, with the counts it
+ * needs until it completes.
+ */
+typedef struct
+{
+    MPI_Request req;
+    int *recvcnts, *displs;
+} buf_exchange_t;
+
+/*
+ * Complete an exchange and verify the received store if it has checksums,
+ * testing the pending requests meanwhile. Returns -1 on a mismatch.
+ */
+static int finish_exchange(buf_exchange_t *ex, const seq_store_t store, MPI_Request *pending, int numpending)
+{
+    MPI_Wait(&ex->req, MPI_STATUS_IGNORE);
+    free(ex->recvcnts);
+    free(ex->displs);
+
+    return store.crcs && verify_crcs(store, pending, numpending)? -1 : 0;
+}
+
+/*
+ * Gather the stores of every process in comm into recv_store, ordered by
+ * rank. Only lengths, gid ranges, checksums (if every process has them) and
+ * the packed buffer go over the wire; offsets are re-derived from the
+ * lengths on the receiving side. The byte offset of the caller's own segment
+ * in recv_store->buf is returned in *selfoffset if it is not NULL. The
+ * buffer exchange is left in flight in *ex; recv_store->buf may only be used
+ * after finish_exchange.
+ */
+static void allgather_store(const seq_store_t send_store, seq_store_t *recv_store, MPI_Comm comm, size_t *selfoffset, buf_exchange_t *ex)
+{
+    int myrank, nprocs;
+    mpi_info(comm, &myrank, &nprocs);
+
+    /*
+     * Sum the number of bytes for the buffer, number of sequences stored, and
+     * the number of total bases.
+     */
+    size_t send_info[4], recv_info[4];
+
+    send_info[0] = send_store.numbytes;
+    send_info[1] = send_store.numseqs;
+    send_info[2] = send_store.totbases;
+    send_info[3] = send_store.crcs != NULL;
+
+    MPI_Allreduce(send_info, recv_info, 4, MPI_SIZE_T, MPI_SUM, comm);
+
+    *recv_store = (seq_store_t){0};
+    recv_store->numbytes = recv_info[0];
+    recv_store->numseqs = recv_info[1];
+    recv_store->totbases = recv_info[2];
+
+    recv_store->buf = buf_alloc(recv_store->numbytes, &recv_store->bufkind);
+    recv_store->lengths = malloc(recv_store->numseqs * sizeof(uint32_t));
+
+    int *recvcnts = malloc(nprocs * sizeof(int));
+    int *displs = malloc(nprocs * sizeof(int));
+    int *seqdispls = malloc(nprocs * sizeof(int));
+
+    /*
+     * Sequence lengths.
+     */
+    int sendcnt = (int)send_store.numseqs;
+
+    recvcnts[myrank] = sendcnt;
+    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, comm);
+    partial_sum(seqdispls, recvcnts, nprocs);
+
+    MPI_Allgatherv(send_store.lengths, sendcnt, MPI_UINT32_T, recv_store->lengths, recvcnts, seqdispls, MPI_UINT32_T, comm);
+
+    if (recv_info[3] == (size_t)nprocs)
+    {
+        recv_store->crcs = malloc(recv_store->numseqs * sizeof(uint32_t));
+        MPI_Allgatherv(send_store.crcs, sendcnt, MPI_UINT32_T, recv_store->crcs, recvcnts, seqdispls, MPI_UINT32_T, comm);
+    }
+
+    /*
+     * Global id ranges, shifted by the local id displacement of their sender.
+     */
+    MPI_Datatype gid_range_mpi_t;
+    MPI_Type_contiguous(2, MPI_SIZE_T, &gid_range_mpi_t);
+    MPI_Type_commit(&gid_range_mpi_t);
+
+    sendcnt = (int)send_store.numranges;
+
+    recvcnts[myrank] = sendcnt;
+    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, comm);
+    partial_sum(displs, recvcnts, nprocs);
+
+    size_t numranges = displs[nprocs-1] + recvcnts[nprocs-1];
+    gid_range_t *ranges = malloc(numranges * sizeof(gid_range_t));
+
+    MPI_Allgatherv(send_store.ranges, sendcnt, gid_range_mpi_t, ranges, recvcnts, displs, gid_range_mpi_t, comm);
+    MPI_Type_free(&gid_range_mpi_t);
+
+    for (int i = 0; i < nprocs; ++i)
+        for (int j = displs[i]; j < displs[i] + recvcnts[i]; ++j)
+            push_gid(recv_store, ranges[j].lid + seqdispls[i], ranges[j].gid);
+
+    recv_store->ranges = realloc(recv_store->ranges, recv_store->numranges * sizeof(gid_range_t));
+    free(ranges);
+
+    /*
+     * Packed sequence buffer.
+     */
+    sendcnt = (int)send_store.numbytes;
+
+    recvcnts[myrank] = sendcnt;
+    MPI_Allgather(MPI_IN_PLACE, 0, MPI_INT, recvcnts, 1, MPI_INT, comm);
+    partial_sum(displs, recvcnts, nprocs);
+
+    /*
+     * The own segment is placed directly and the rest gathered around it.
+     */
+    if (sendcnt) memcpy(recv_store->buf + displs[myrank], send_store.buf, sendcnt);
+    if (selfoffset) *selfoffset = displs[myrank];
+
+    ex->req = MPI_REQUEST_NULL;
+    ex->recvcnts = recvcnts;
+    ex->displs = displs;
+
+    if (wire_allgather(send_store.buf, sendcnt, recv_store->buf, recvcnts, displs, comm))
+        MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_UINT8_T, recv_store->buf, recvcnts, displs, MPI_UINT8_T, comm, &ex->req);
+
+    sample_offsets(recv_store);
+    seq_store_index_gids(recv_store);
+
+    free(seqdispls);
+}
+
+/* blocking version */
+int seq_store_share(const seq_store_t send_store, seq_store_t *row_store, seq_store_t *col_store, commgrid_t const *grid)
+{
+    if (!row_store || !col_store || !grid)
+        return -1;
+
+    buf_exchange_t rowex, colex;
+    double t = MPI_Wtime();
+
+    allgather_store(send_store, row_store, grid->row_world, NULL, &rowex);
+    allgather_store(send_store, col_store, grid->col_world, NULL, &colex);
+
+    /* the row store is verified while the column buffers are in flight */
+    int err = finish_exchange(&rowex, *row_store, &colex.req, 1);
+    err |= finish_exchange(&colex, *col_store, NULL, 0);
+
+    sharetime += MPI_Wtime() - t;
+    return err;
+}
+
+/*
+ * Like seq_store_share, but store does not keep a copy of its own sequences:
+ * afterwards store's buffer is released and store views its own segment of
+ * row_store. store must not be used after row_store is freed.
+ */
+int seq_store_share_shared(seq_store_t *store, seq_store_t *row_store, seq_store_t *col_store, commgrid_t const *grid)
+{
+    if (!store || !row_store || !col_store || !grid)
+        return -1;
+
+    size_t selfoffset;
+    buf_exchange_t rowex, colex;
+    double t = MPI_Wtime();
+
+    allgather_store(*store, row_store, grid->row_world, &selfoffset, &rowex);
+    allgather_store(*store, col_store, grid->col_world, NULL, &colex);
+
+    /* the row store is verified while the column buffers are in flight */
+    int err = finish_exchange(&rowex, *row_store, &colex.req, 1);
+    err |= finish_exchange(&colex, *col_store, NULL, 0);
+
+    buf_free(store->buf, store->numbytes, store->bufkind);
+    store->buf = row_store->buf + selfoffset;
+    store->bufkind = SEQ_BUF_BORROWED;
+
+    sharetime += MPI_Wtime() - t;
+    return err;
+}
+
+/*
+ * Persistent share: counts, displacements and receive buffers are set up once
+ * by seq_share_plan_init, and every seq_share_plan_start/seq_share_plan_wait
+ * pair reruns the six buffer exchanges (lengths, gid ranges and packed bytes,
+ * along rows and columns), plus one checksum exchange per side if every
+ * process's store has checksums. With MPI-4 these are persistent collectives
+ * (MPI_Allgatherv_init); otherwise each start posts MPI_Iallgatherv.
+ */
+static void plan_side_init(seq_share_side_t *side, const seq_share_plan_t *plan, MPI_Comm comm)
+{
+    int nprocs, myrank;
+    mpi_info(comm, &myrank, &nprocs);
+
+    int shape[3] = {(int)plan->numseqs, (int)plan->numranges, (int)plan->numbytes};
+    int *shapes = malloc(3 * nprocs * sizeof(int));
+
+    MPI_Allgather(shape, 3, MPI_INT, shapes, 3, MPI_INT, comm);
+
+    side->comm = comm;
+    side->nprocs = nprocs;
+
+    size_t totals[3] = {0, 0, 0};
+
+    for (int k = 0; k < 3; ++k)
+    {
+        side->cnts[k] = malloc(nprocs * sizeof(int));
+        side->displs[k] = malloc(nprocs * sizeof(int));
+
+        for (int i = 0; i < nprocs; ++i)
+        {
+            side->cnts[k][i] = shapes[3*i+k];
+            totals[k] += shapes[3*i+k];
+        }
+
+        partial_sum(side->displs[k], side->cnts[k], nprocs);
+    }
+
+    free(shapes);
+
+    side->store = (seq_store_t){0};
+    side->store.numseqs = totals[0];
+    side->store.numbytes = totals[2];
+    side->store.lengths = malloc(totals[0] * sizeof(uint32_t));
+    side->store.crcs = plan->crcs? malloc(totals[0] * sizeof(uint32_t)) : NULL;
+    side->store.buf = buf_alloc(totals[2], &side->store.bufkind);
+    side->store.samples = malloc((totals[0] / SEQ_STORE_SAMPLE + 1) * sizeof(size_t));
+    side->store.ranges = malloc(totals[1] * sizeof(gid_range_t));
+    side->numranges = totals[1];
+    side->ranges = malloc(totals[1] * sizeof(gid_range_t));
+    side->prevranges = malloc(totals[1] * sizeof(gid_range_t));
+}
+
+/*
+ * Refill the receive store's metadata in the buffers sized by
+ * plan_side_init. Offsets and totbases follow the received lengths. The gid
+ * ranges and index are only rebuilt when the received ranges differ from
+ * those of the previous exchange, which they do not when the same store is
+ * shared again.
+ */
+static void plan_side_finish(seq_share_side_t *side)
+{
+    seq_store_t *store = &side->store;
+    size_t offset = 0;
+
+    store->totbases = 0;
+
+    for (size_t i = 0; i < store->numseqs; ++i)
+    {
+        if (i % SEQ_STORE_SAMPLE == 0)
+            store->samples[i / SEQ_STORE_SAMPLE] = offset;
+
+        offset += (store->lengths[i] + 3) / 4;
+        store->totbases += store->lengths[i];
+    }
+
+    if (!store->numseqs)
+        store->samples[0] = 0;
+
+    if (store->gidindex && !memcmp(side->ranges, side->prevranges, side->numranges * sizeof(gid_range_t)))
+        return;
+
+    /* merge ranges that continue across process boundaries, as push_gid does */
+    store->numranges = 0;
+
+    for (int i = 0; i < side->nprocs; ++i)
+    {
+        for (int j = side->displs[1][i]; j < side->displs[1][i] + side->cnts[1][i]; ++j)
+        {
+            size_t lid = side->ranges[j].lid + side->displs[0][i], gid = side->ranges[j].gid;
+            gid_range_t const *last = store->numranges? &store->ranges[store->numranges-1] : NULL;
+
+            if (!last || last->gid + (lid - last->lid) != gid)
+                store->ranges[store->numranges++] = (gid_range_t){lid, gid};
+        }
+    }
+
+    memcpy(side->prevranges, side->ranges, side->numranges * sizeof(gid_range_t));
+    seq_store_index_gids(store);
+}
+
+static void plan_side_free(seq_share_side_t *side)
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        free(side->cnts[k]);
+        free(side->displs[k]);
+    }
+
+    free(side->ranges);
+    free(side->prevranges);
+    seq_store_free(&side->store);
+}
+
+/*
+ * Post (or, with MPI-4, create) the plan->numreqs exchanges of one side.
+ */
+static void plan_side_post(seq_share_plan_t *plan, seq_share_side_t *side, MPI_Request *reqs)
+{
+#if MPI_VERSION >= 4
+    MPI_Allgatherv_init(plan->lengths, (int)plan->numseqs, MPI_UINT32_T, side->store.lengths, side->cnts[0], side->displs[0], MPI_UINT32_T, side->comm, MPI_INFO_NULL, &reqs[0]);
+    MPI_Allgatherv_init(plan->ranges, (int)plan->numranges, plan->range_mpi_t, side->ranges, side->cnts[1], side->displs[1], plan->range_mpi_t, side->comm, MPI_INFO_NULL, &reqs[1]);
+    MPI_Allgatherv_init(plan->buf, (int)plan->numbytes, MPI_UINT8_T, side->store.buf, side->cnts[2], side->displs[2], MPI_UINT8_T, side->comm, MPI_INFO_NULL, &reqs[2]);
+
+    if (plan->crcs)
+        MPI_Allgatherv_init(plan->crcs, (int)plan->numseqs, MPI_UINT32_T, side->store.crcs, side->cnts[0], side->displs[0], MPI_UINT32_T, side->comm, MPI_INFO_NULL, &reqs[3]);
+#else
+    MPI_Iallgatherv(plan->lengths, (int)plan->numseqs, MPI_UINT32_T, side->store.lengths, side->cnts[0], side->displs[0], MPI_UINT32_T, side->comm, &reqs[0]);
+    MPI_Iallgatherv(plan->ranges, (int)plan->numranges, plan->range_mpi_t, side->ranges, side->cnts[1], side->displs[1], plan->range_mpi_t, side->comm, &reqs[1]);
+    MPI_Iallgatherv(plan->buf, (int)plan->numbytes, MPI_UINT8_T, side->store.buf, side->cnts[2], side->displs[2], MPI_UINT8_T, side->comm, &reqs[2]);
+
+    if (plan->crcs)
+        MPI_Iallgatherv(plan->crcs, (int)plan->numseqs, MPI_UINT32_T, side->store.crcs, side->cnts[0], side->displs[0], MPI_UINT32_T, side->comm, &reqs[3]);
+#endif
+}
+
+int seq_share_plan_init(seq_share_plan_t *plan, const seq_store_t send_store, commgrid_t const *grid)
+{
+    if (!plan || !grid)
+        return -1;
+
+    *plan = (seq_share_plan_t){0};
+    plan->grid = grid;
+    plan->numseqs = send_store.numseqs;
+    plan->numranges = send_store.numranges;
+    plan->numbytes = send_store.numbytes;
+
+    plan->lengths = malloc(plan->numseqs * sizeof(uint32_t));
+    plan->ranges = malloc(plan->numranges * sizeof(gid_range_t));
+    plan->buf = malloc(plan->numbytes);
+
+    int checked = send_store.crcs != NULL, allchecked;
+    MPI_Allreduce(&checked, &allchecked, 1, MPI_INT, MPI_LAND, grid->grid_world);
+
+    plan->numreqs = allchecked? 4 : 3;
+    plan->crcs = allchecked? malloc(plan->numseqs * sizeof(uint32_t)) : NULL;
+
+    MPI_Type_contiguous(2, MPI_SIZE_T, &plan->range_mpi_t);
+    MPI_Type_commit(&plan->range_mpi_t);
+
+    plan_side_init(&plan->row, plan, grid->row_world);
+    plan_side_init(&plan->col, plan, grid->col_world);
+
+#if MPI_VERSION >= 4
+    plan_side_post(plan, &plan->row, plan->reqs);
+    plan_side_post(plan, &plan->col, plan->reqs + SEQ_PLAN_REQS);
+#endif
+
+    return 0;
+}
+
+/*
+ * Start exchanging send_store, which must have the shape (number of
+ * sequences, gid ranges and bytes) that the plan was made for, and
+ * checksums if the plan ships them; returns -1 otherwise. send_store is
+ * copied, so it may be freed or modified before the matching
+ * seq_share_plan_wait.
+ */
+int seq_share_plan_start(seq_share_plan_t *plan, const seq_store_t send_store)
+{
+    if (!plan || plan->active)
+        return -1;
+
+    if (send_store.numseqs != plan->numseqs || send_store.numranges != plan->numranges || send_store.numbytes != plan->numbytes)
+        return -1;
+
+    if (plan->crcs && !send_store.crcs)
+        return -1;
+
+    memcpy(plan->lengths, send_store.lengths, plan->numseqs * sizeof(uint32_t));
+    memcpy(plan->ranges, send_store.ranges, plan->numranges * sizeof(gid_range_t));
+    memcpy(plan->buf, send_store.buf, plan->numbytes);
+
+    if (plan->crcs)
+        memcpy(plan->crcs, send_store.crcs, plan->numseqs * sizeof(uint32_t));
+
+#if MPI_VERSION >= 4
+    MPI_Startall(plan->numreqs, plan->reqs);
+    MPI_Startall(plan->numreqs, plan->reqs + SEQ_PLAN_REQS);
+#else
+    plan_side_post(plan, &plan->row, plan->reqs);
+    plan_side_post(plan, &plan->col, plan->reqs + SEQ_PLAN_REQS);
+#endif
+
+    plan->active = 1;
+    return 0;
+}
+
+/*
+ * Complete the exchange. The returned stores belong to the plan and stay
+ * valid until the next seq_share_plan_start or seq_share_plan_free. Returns
+ * -1 if a received sequence does not match its checksum; the stores are
+ * still returned.
+ */
+int seq_share_plan_wait(seq_share_plan_t *plan, seq_store_t const **row_store, seq_store_t const **col_store)
+{
+    if (!plan || !plan->active)
+        return -1;
+
+    double t = MPI_Wtime();
+    int err = 0;
+
+    /* the row store is verified while the column exchanges are in flight */
+    MPI_Waitall(plan->numreqs, plan->reqs, MPI_STATUSES_IGNORE);
+    plan_side_finish(&plan->row);
+
+    if (plan->crcs && verify_crcs(plan->row.store, plan->reqs + SEQ_PLAN_REQS, plan->numreqs))
+        err = -1;
+
+    MPI_Waitall(plan->numreqs, plan->reqs + SEQ_PLAN_REQS, MPI_STATUSES_IGNORE);
+    plan_side_finish(&plan->col);
+
+    if (plan->crcs && verify_crcs(plan->col.store, NULL, 0))
+        err = -1;
+
+    plan->active = 0;
+    sharetime += MPI_Wtime() - t;
+
+    if (row_store) *row_store = &plan->row.store;
+    if (col_store) *col_store = &plan->col.store;
+
+    return err;
+}
+
+int seq_share_plan_free(seq_share_plan_t *plan)
+{
+    if (!plan) return -1;
+
+    if (plan->active)
+    {
+        MPI_Waitall(plan->numreqs, plan->reqs, MPI_STATUSES_IGNORE);
+        MPI_Waitall(plan->numreqs, plan->reqs + SEQ_PLAN_REQS, MPI_STATUSES_IGNORE);
+    }
+
+#if MPI_VERSION >= 4
+    for (int i = 0; i < plan->numreqs; ++i)
+    {
+        MPI_Request_free(&plan->reqs[i]);
+        MPI_Request_free(&plan->reqs[SEQ_PLAN_REQS + i]);
+    }
+#endif
+
+    plan_side_free(&plan->row);
+    plan_side_free(&plan->col);
+
+    MPI_Type_free(&plan->range_mpi_t);
+    free(plan->lengths);
+    free(plan->ranges);
+    free(plan->buf);
+    free(plan->crcs);
+    *plan = (seq_share_plan_t){0};
+
+    return 0;
+}
+
+#define SEQ_META_BYTES (sizeof(size_t) + sizeof(uint32_t)) /* gid and length of one sequence on the wire, then its checksum if any */
+
+/*
+ * Send every local sequence i to process dests[i] of comm. Received sequences
+ * are ordered by source rank and then by their local id at the source. Each
+ * destination gets one contiguous block holding the gids and lengths (and
+ * checksums) of its sequences followed by their packed bytes, so that a
+ * single MPI_Alltoallv (after one MPI_Alltoall of block sizes) moves
+ * everything.
+ */
+int seq_store_redistribute(const seq_store_t send_store, int const *dests, seq_store_t *recv_store, MPI_Comm comm)
+{
+    int nprocs;
+
+    if (!recv_store || (send_store.numseqs && !dests))
+        return -1;
+
+    mpi_info(comm, NULL, &nprocs);
+
+    /* checksums travel with the lengths if every sender has them */
+    int checked = send_store.crcs != NULL, allchecked;
+    MPI_Allreduce(&checked, &allchecked, 1, MPI_INT, MPI_LAND, comm);
+
+    size_t metabytes = SEQ_META_BYTES + (allchecked? sizeof(uint32_t) : 0);
+
+    /*
+     * Number of sequences and block bytes sent to each destination.
+     */
+    size_t *sendinfo = calloc(2*nprocs, sizeof(size_t));
+    size_t *recvinfo = malloc(2*nprocs * sizeof(size_t));
+
+    for (size_t i = 0; i < send_store.numseqs; ++i)
+    {
+        assert(dests[i] >= 0 && dests[i] < nprocs);
+        sendinfo[2*dests[i]]++;
+        sendinfo[2*dests[i]+1] += metabytes + (seq_store_length(send_store, i) + 3) / 4;
+    }
+
+    MPI_Alltoall(sendinfo, 2, MPI_SIZE_T, recvinfo, 2, MPI_SIZE_T, comm);
+
+    size_t *sdispls = malloc((nprocs+1) * sizeof(size_t));
+    size_t *rdispls = malloc((nprocs+1) * sizeof(size_t));
+    size_t *metapos = malloc(nprocs * sizeof(size_t));
+    size_t *bytepos = malloc(nprocs * sizeof(size_t));
+
+    sdispls[0] = rdispls[0] = 0;
+
+    for (int i = 0; i < nprocs; ++i)
+    {
+        sdispls[i+1] = sdispls[i] + sendinfo[2*i+1];
+        rdispls[i+1] = rdispls[i] + recvinfo[2*i+1];
+        metapos[i] = sdispls[i];
+        bytepos[i] = sdispls[i] + sendinfo[2*i] * metabytes;
+    }
+
+    /*
+     * Pack every sequence into its destination block. Sequences start on byte
+     * boundaries, so whole bytes are copied.
+     */
+    uint8_t *sendbuf = malloc(sdispls[nprocs]);
+    uint8_t *recvbuf = malloc(rdispls[nprocs]);
+
+    for (size_t i = 0; i < send_store.numseqs; ++i)
+    {
+        int dest = dests[i];
+        size_t gid = seq_store_gid(send_store, i);
+        uint32_t len = send_store.lengths[i];
+        size_t n = (len + 3) / 4;
+
+        memcpy(sendbuf + metapos[dest], &gid, sizeof(size_t));
+        memcpy(sendbuf + metapos[dest] + sizeof(size_t), &len, sizeof(uint32_t));
+
+        if (allchecked)
+            memcpy(sendbuf + metapos[dest] + SEQ_META_BYTES, &send_store.crcs[i], sizeof(uint32_t));
+        memcpy(sendbuf + bytepos[dest], send_store.buf + seq_store_offset(send_store, i), n);
+
+        metapos[dest] += metabytes;
+        bytepos[dest] += n;
+    }
+
+    free(metapos);
+    free(bytepos);
+
+    /*
+     * Exchange all blocks in one round.
+     */
+#if MPI_VERSION >= 4
+    MPI_Count *scounts = malloc(nprocs * sizeof(MPI_Count)), *rcounts = malloc(nprocs * sizeof(MPI_Count));
+    MPI_Aint *sdisps = malloc(nprocs * sizeof(MPI_Aint)), *rdisps = malloc(nprocs * sizeof(MPI_Aint));
+
+    for (int i = 0; i < nprocs; ++i)
+    {
+        scounts[i] = sendinfo[2*i+1];
+        rcounts[i] = recvinfo[2*i+1];
+        sdisps[i] = sdispls[i];
+        rdisps[i] = rdispls[i];
+    }
+
+    MPI_CHECK(MPI_Alltoallv_c(sendbuf, scounts, sdisps, MPI_UINT8_T, recvbuf, rcounts, rdisps, MPI_UINT8_T, comm));
+
+    free(scounts); free(rcounts); free(sdisps); free(rdisps);
+#else
+    /*
+     * Without large-count collectives, counts and displacements are int. If
+     * the buffers are too large for that, exchange them in units of 2^e bytes
+     * (with a contiguous datatype), padding the buffers to whole units.
+     */
+    size_t maxdispl = sdispls[nprocs] > rdispls[nprocs]? sdispls[nprocs] : rdispls[nprocs];
+    MPI_Allreduce(MPI_IN_PLACE, &maxdispl, 1, MPI_SIZE_T, MPI_MAX, comm);
+
+    size_t unit = 1;
+    while (maxdispl / unit + nprocs > INT_MAX) unit *= 2;
+
+    int *scounts = malloc(nprocs * sizeof(int)), *rcounts = malloc(nprocs * sizeof(int));
+    int *sdisps = malloc(nprocs * sizeof(int)), *rdisps = malloc(nprocs * sizeof(int));
+
+    if (unit == 1)
+    {
+        for (int i = 0; i < nprocs; ++i)
+        {
+            scounts[i] = (int)sendinfo[2*i+1];
+            sdisps[i] = (int)sdispls[i];
+            rcounts[i] = (int)recvinfo[2*i+1];
+            rdisps[i] = (int)rdispls[i];
+        }
+
+        MPI_Alltoallv(sendbuf, scounts, sdisps, MPI_UINT8_T, recvbuf, rcounts, rdisps, MPI_UINT8_T, comm);
+    }
+    else
+    {
+        /*
+         * Pad every destination block to whole units in a staging buffer so
+         * that block boundaries line up with the datatype's extent.
+         */
+        size_t stotal = 0, rtotal = 0;
+
+        for (int i = 0; i < nprocs; ++i)
+        {
+            scounts[i] = (int)((sendinfo[2*i+1] + unit - 1) / unit);
+            rcounts[i] = (int)((recvinfo[2*i+1] + unit - 1) / unit);
+            sdisps[i] = (int)stotal;
+            rdisps[i] = (int)rtotal;
+            stotal += scounts[i];
+            rtotal += rcounts[i];
+        }
+
+        uint8_t *sstage = malloc(stotal * unit);
+        uint8_t *rstage = malloc(rtotal * unit);
+
+        for (int i = 0; i < nprocs; ++i)
+            memcpy(sstage + sdisps[i] * unit, sendbuf + sdispls[i], sendinfo[2*i+1]);
+
+        MPI_Datatype unit_mpi_t;
+        MPI_Type_contiguous((int)unit, MPI_UINT8_T, &unit_mpi_t);
+        MPI_Type_commit(&unit_mpi_t);
+
+        MPI_Alltoallv(sstage, scounts, sdisps, unit_mpi_t, rstage, rcounts, rdisps, unit_mpi_t, comm);
+        MPI_Type_free(&unit_mpi_t);
+
+        for (int i = 0; i < nprocs; ++i)
+            memcpy(recvbuf + rdispls[i], rstage + rdisps[i] * unit, recvinfo[2*i+1]);
+
+        free(sstage);
+        free(rstage);
+    }
+
+    free(scounts); free(rcounts); free(sdisps); free(rdisps);
+#endif
+
+    free(sendbuf);
+
+    /*
+     * Rebuild the store from the received blocks.
+     */
+    size_t numseqs = 0, numbytes = 0;
+
+    for (int i = 0; i < nprocs; ++i)
+    {
+        numseqs += recvinfo[2*i];
+        numbytes += recvinfo[2*i+1] - recvinfo[2*i] * metabytes;
+    }
+
+    *recv_store = (seq_store_t){0};
+    recv_store->buf = buf_alloc(numbytes, &recv_store->bufkind);
+    recv_store->lengths = malloc(numseqs * sizeof(uint32_t));
+    recv_store->crcs = allchecked? malloc((numseqs? numseqs : 1) * sizeof(uint32_t)) : NULL;
+
+    for (int i = 0; i < nprocs; ++i)
+    {
+        uint8_t *meta = recvbuf + rdispls[i];
+        uint8_t *bytes = meta + recvinfo[2*i] * metabytes;
+        size_t blockbytes = recvinfo[2*i+1] - recvinfo[2*i] * metabytes;
+
+        for (size_t j = 0; j < recvinfo[2*i]; ++j)
+        {
+            size_t gid;
+            uint32_t len;
+
+            memcpy(&gid, meta + j*metabytes, sizeof(size_t));
+            memcpy(&len, meta + j*metabytes + sizeof(size_t), sizeof(uint32_t));
+
+            if (allchecked)
+                memcpy(&recv_store->crcs[recv_store->numseqs], meta + j*metabytes + SEQ_META_BYTES, sizeof(uint32_t));
+
+            push_gid(recv_store, recv_store->numseqs, gid);
+            recv_store->lengths[recv_store->numseqs++] = len;
+            recv_store->totbases += len;
+        }
+
+        memcpy(recv_store->buf + recv_store->numbytes, bytes, blockbytes);
+        recv_store->numbytes += blockbytes;
+    }
+
+    recv_store->ranges = realloc(recv_store->ranges, recv_store->numranges * sizeof(gid_range_t));
+    sample_offsets(recv_store);
+    seq_store_index_gids(recv_store);
+
+    free(recvbuf);
+    free(sendinfo);
+    free(recvinfo);
+    free(sdispls);
+    free(rdispls);
+
+    return recv_store->crcs && verify_crcs(*recv_store, NULL, 0)? -1 : 0;
+}
+
+/*
+ * Copy the local sequences i with keep[i] != 0 into sub_store, in order and
+ * with their global ids.
+ */
+int seq_store_select(const seq_store_t store, uint8_t const *keep, seq_store_t *sub_store)
+{
+    if (!sub_store || (store.numseqs && !keep))
+        return -1;
+
+    size_t numseqs = 0, numbytes = 0;
+
+    for (size_t i = 0; i < store.numseqs; ++i)
+    {
+        if (!keep[i]) continue;
+
+        numseqs++;
+        numbytes += (store.lengths[i] + 3) / 4;
+    }
+
+    *sub_store = (seq_store_t){0};
+    sub_store->buf = malloc(numbytes);
+    sub_store->lengths = malloc(numseqs * sizeof(uint32_t));
+    sub_store->crcs = store.crcs? malloc(numseqs * sizeof(uint32_t)) : NULL;
+
+    size_t offset = 0;
+
+    for (size_t i = 0; i < store.numseqs; ++i)
+    {
+        size_t n = (store.lengths[i] + 3) / 4;
+
+        if (keep[i])
+        {
+            memcpy(sub_store->buf + sub_store->numbytes, store.buf + offset, n);
+            push_gid(sub_store, sub_store->numseqs, seq_store_gid(store, i));
+            if (sub_store->crcs) sub_store->crcs[sub_store->numseqs] = store.crcs[i];
+            sub_store->lengths[sub_store->numseqs++] = store.lengths[i];
+            sub_store->numbytes += n;
+            sub_store->totbases += store.lengths[i];
+        }
+
+        offset += n;
+    }
+
+    sub_store->ranges = realloc(sub_store->ranges, sub_store->numranges * sizeof(gid_range_t));
+    sample_offsets(sub_store);
+
+    return 0;
+}
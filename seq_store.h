@@ -4,23 +4,255 @@
 #include "fasta_index.h"
 #include "mpiutil.h"
 #include "mstring.h"
+#include <assert.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Offsets are not stored per sequence: every sequence occupies (len+3)/4
+ * bytes right after its predecessor, so only the offset of every
+ * SEQ_STORE_SAMPLE'th sequence is kept and the rest are summed from lengths.
+ */
+#define SEQ_STORE_SAMPLE 16
+
+/*
+ * Run of consecutive global ids: local ids lid, lid+1, ... map to global ids
+ * gid, gid+1, ... up to the start of the next range.
+ */
+typedef struct { size_t lid, gid; } gid_range_t;
+
+/*
+ * How the buffer of a seq_store_t was allocated.
+ */
+#define SEQ_BUF_HEAP 0   /* malloc'd, not counted against the memory budget */
+#define SEQ_BUF_BUDGET 1 /* malloc'd by the budgeted store allocator */
+#define SEQ_BUF_MAPPED 2 /* mmap'd scratch file, allocated when over budget */
+#define SEQ_BUF_BORROWED 3 /* view into another store's buffer, never freed */
+
+#define SEQ_STORE_SEQUENTIAL 0
+#define SEQ_STORE_RANDOM 1
+
+/*
+ * Wire compression of the packed buffers exchanged by the share functions.
+ */
+#define SEQ_WIRE_OFF 0
+#define SEQ_WIRE_AUTO 1 /* compress when a local probe predicts a net win */
+#define SEQ_WIRE_ON 2
+
+/*
+ * Index from global ids to local ids (see seq_store_index_gids). Stores whose
+ * global ids form few runs, such as row and column stores with one run per
+ * source process, get a range table: the runs sorted by gid plus a directory
+ * of buckets over the gid span, each pointing at the run holding the start
+ * of the bucket. Other stores get an open-addressing hash table.
+ */
+typedef struct { size_t gid, lid, len; } gid_run_t;
+typedef struct { size_t gid, lid; } gid_slot_t;
+
+typedef struct
+{
+    gid_run_t *runs;   /* runs of consecutive gids, sorted by gid */
+    size_t numruns;
+    size_t mingid;     /* bucket b covers gids mingid + [b << shift, (b+1) << shift) */
+    int shift;
+    size_t *buckets;   /* run holding the first gid of each bucket */
+    size_t numbuckets;
+    gid_slot_t *slots; /* hash table, NULL for a range table */
+    size_t mask;       /* number of slots - 1 */
+} seq_gid_index_t;
+
+#define SEQ_STORE_NOTFOUND ((size_t)-1)
 
 typedef struct
 {
     uint8_t *buf; /* encoded sequence buffer (2 bits per nucleotide) */
-    size_t *lengths; /* sequence lengths */
-    size_t *offsets; /* sequence buffer offsets */
-    size_t *gids;    /* global sequence ids */
-    size_t numbytes; /* buffer length */
-    size_t numseqs;  /* number of sequences */
-    size_t totbases; /* total number of nucleotides stored */
+    uint32_t *lengths;   /* sequence lengths */
+    size_t *samples;     /* buffer offsets of every SEQ_STORE_SAMPLE'th sequence */
+    gid_range_t *ranges; /* global sequence id ranges, sorted by lid */
+    size_t numranges; /* number of global id ranges */
+    size_t numbytes;  /* buffer length */
+    size_t numseqs;   /* number of sequences */
+    size_t totbases;  /* total number of nucleotides stored */
+    int bufkind;      /* SEQ_BUF_* */
+    seq_gid_index_t *gidindex; /* global id lookup, NULL if not built */
+    uint32_t *crcs;   /* CRC32C of every sequence's packed bytes, NULL unless enabled (see seq_store_set_crc) */
+    int checksummed;  /* crcs are computed while encoding, set from seq_store_set_crc when encoding starts */
 } seq_store_t;
 
+static inline size_t seq_store_length(const seq_store_t store, size_t lid)
+{
+    return store.lengths[lid];
+}
+
+static inline size_t seq_store_offset(const seq_store_t store, size_t lid)
+{
+    size_t offset = store.samples[lid / SEQ_STORE_SAMPLE];
+
+    for (size_t i = lid - (lid % SEQ_STORE_SAMPLE); i < lid; ++i)
+        offset += (store.lengths[i] + 3) / 4;
+
+    return offset;
+}
+
+static inline size_t seq_store_gid(const seq_store_t store, size_t lid)
+{
+    size_t lo = 0, hi = store.numranges;
+
+    /* find the last range with ranges[lo].lid <= lid */
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if (store.ranges[mid].lid <= lid) lo = mid;
+        else hi = mid;
+    }
+
+    return store.ranges[lo].gid + (lid - store.ranges[lo].lid);
+}
+
+static inline size_t seq_gid_hash(size_t gid)
+{
+    uint64_t h = gid * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+/*
+ * Local id of global id gid, or SEQ_STORE_NOTFOUND. The store must have a
+ * gid index: stores from the share functions, seq_store_read_filtered and
+ * seq_store_redistribute have one, others need seq_store_index_gids.
+ */
+static inline size_t seq_store_lid(const seq_store_t store, size_t gid)
+{
+    seq_gid_index_t const *index = store.gidindex;
+
+    assert(index);
+
+    if (index->slots)
+    {
+        for (size_t i = seq_gid_hash(gid) & index->mask; ; i = (i+1) & index->mask)
+        {
+            if (index->slots[i].gid == gid || index->slots[i].lid == SEQ_STORE_NOTFOUND)
+                return index->slots[i].lid;
+        }
+    }
+
+    if (gid < index->mingid || !index->numruns)
+        return SEQ_STORE_NOTFOUND;
+
+    size_t b = (gid - index->mingid) >> index->shift;
+    size_t r = index->buckets[b < index->numbuckets? b : index->numbuckets-1];
+
+    while (r+1 < index->numruns && index->runs[r+1].gid <= gid)
+        r++;
+
+    gid_run_t const *run = &index->runs[r];
+
+    return gid - run->gid < run->len? run->lid + (gid - run->gid) : SEQ_STORE_NOTFOUND;
+}
+
+/*
+ * Load-time filters for seq_store_read_filtered. Start from SEQ_FILTER_INIT,
+ * which disables every filter.
+ */
+typedef struct
+{
+    size_t min_len;          /* minimum sequence length */
+    size_t max_len;          /* maximum sequence length (0 for none) */
+    double max_n_frac;       /* maximum fraction of N/non-ACGT bases (>= 1 for none) */
+    double max_dust;         /* maximum DUST low-complexity score (0 for none) */
+    size_t const *whitelist; /* sorted global ids to keep (NULL for all) */
+    size_t whitelist_len;
+} seq_filter_t;
+
+#define SEQ_FILTER_INIT (seq_filter_t){0, 0, 1.0, 0, NULL, 0}
+
+/*
+ * Persistent row/column share, planned once for a fixed send shape and then
+ * started many times (see seq_share_plan_init). Only MPI-4 has persistent
+ * collectives; without them every start posts the nonblocking exchanges
+ * again, and the plan only saves the count/displacement exchanges and the
+ * receive buffer allocation of seq_store_share.
+ */
+typedef struct
+{
+    MPI_Comm comm;
+    int nprocs;
+    int *cnts[3], *displs[3]; /* lengths, gid ranges and bytes per process */
+    gid_range_t *ranges;      /* gid ranges as received */
+    gid_range_t *prevranges;  /* ranges the store's gid metadata was built from */
+    size_t numranges;         /* number of received gid ranges */
+    seq_store_t store;        /* receive store */
+} seq_share_side_t;
+
+typedef struct
+{
+    commgrid_t const *grid;
+    size_t numseqs, numranges, numbytes; /* send shape */
+    uint32_t *lengths;                   /* send staging buffers */
+    gid_range_t *ranges;
+    uint8_t *buf;
+    uint32_t *crcs;                      /* NULL unless the plan ships checksums */
+    MPI_Datatype range_mpi_t;
+    seq_share_side_t row, col;
+    MPI_Request reqs[8];                 /* row exchanges first, column ones from SEQ_PLAN_REQS */
+    int numreqs;                         /* exchanges per side: 3, or 4 with checksums */
+    int active;
+} seq_share_plan_t;
+
+#define SEQ_PLAN_REQS 4
+
+typedef int (*seq_store_batch_fn)(int batch, int numbatches, seq_store_t const *store, seq_store_t const *row_store, seq_store_t const *col_store, void *arg);
+
 int seq_store_read(seq_store_t *store, char const *fname, const fasta_index_t faidx);
+int seq_store_read_files(seq_store_t *store, char const * const *fnames, const fasta_index_t faidx);
+int seq_store_read_filtered(seq_store_t *store, char const *fname, const fasta_index_t faidx, seq_filter_t const *filter, size_t **origids);
+int seq_store_stream(char const *fname, const fasta_index_t faidx, size_t membudget, seq_store_batch_fn fn, void *arg);
+int seq_store_stream_files(char const * const *fnames, const fasta_index_t faidx, size_t membudget, seq_store_batch_fn fn, void *arg);
 int seq_store_free(seq_store_t *store);
+int seq_store_index_gids(seq_store_t *store);
+void seq_store_lids(const seq_store_t store, size_t const *gids, size_t n, size_t *lids);
+void seq_store_set_membudget(size_t budget, char const *scratchdir);
+int seq_store_advise(const seq_store_t store, int access);
+void seq_store_mem_report(commgrid_t const *grid, FILE *f);
+void seq_store_set_wire(int mode, double bandwidth);
+void seq_store_wire_report(commgrid_t const *grid, FILE *f);
+void seq_store_set_crc(int on);
+void seq_store_crc_report(commgrid_t const *grid, FILE *f);
 void seq_store_info(const seq_store_t store, char const *fname, commgrid_t const *grid);
 void seq_store_log(const seq_store_t store, char const *fname_prefix, string_store_t const *names, MPI_Comm comm);
 int seq_store_share(const seq_store_t send_store, seq_store_t *row_store, seq_store_t *col_store, commgrid_t const *grid);
+int seq_store_select(const seq_store_t store, uint8_t const *keep, seq_store_t *sub_store);
+
+/*
+ * recv_store of seq_store_redistribute comes with a gid index. If every
+ * process of comm sends checksums, they are carried along and verified, and
+ * seq_store_redistribute returns -1 on a mismatch. Like every received
+ * store, recv_store is not checksummed (it computes no new CRCs).
+ */
+int seq_store_redistribute(const seq_store_t send_store, int const *dests, seq_store_t *recv_store, MPI_Comm comm);
+
+/*
+ * seq_store_share_shared frees store's buffer and makes store a view of its
+ * own segment of row_store's buffer, so store must not be used once
+ * row_store is freed.
+ */
+int seq_store_share_shared(seq_store_t *store, seq_store_t *row_store, seq_store_t *col_store, commgrid_t const *grid);
+
+int seq_share_plan_init(seq_share_plan_t *plan, const seq_store_t send_store, commgrid_t const *grid);
+int seq_share_plan_start(seq_share_plan_t *plan, const seq_store_t send_store);
+int seq_share_plan_wait(seq_share_plan_t *plan, seq_store_t const **row_store, seq_store_t const **col_store);
+int seq_share_plan_free(seq_share_plan_t *plan);
 int seq_store_get(const seq_store_t store, size_t lid, size_t *gid, char **seq);
+int seq_store_get_revcomp(const seq_store_t store, size_t lid, size_t *gid, char **seq);
+size_t seq_store_decode(const seq_store_t store, size_t lid, size_t start, size_t end, int revcomp, char *dest);
+size_t seq_store_extract(const seq_store_t store, size_t lid, size_t start, size_t end, uint8_t *dest);
+size_t seq_store_extract_revcomp(const seq_store_t store, size_t lid, size_t start, size_t end, uint8_t *dest);
+void packed_revcomp(uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
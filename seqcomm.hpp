@@ -0,0 +1,430 @@
+#ifndef SEQCOMM_HPP_
+#define SEQCOMM_HPP_
+
+#include "fasta_index.h"
+#include "seq_store.h"
+#include "mstring.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+/*
+ * Header-only C++17 layer over the C stores. Owners are move-only and free
+ * through the C destructors; views borrow a C struct and never copy or
+ * decode. A seq_store_t can come from either side: a C function fills an
+ * owner through out(), and stores owned elsewhere (e.g. by a share plan) are
+ * wrapped in a store_view.
+ *
+ *     seqcomm::store local, row, col;
+ *     seq_store_read(local.out(), fname, faidx.c());
+ *     seq_store_share(local.c(), row.out(), col.out(), &grid);
+ *
+ *     for (seqcomm::packed_view seq : row)
+ *         n = seqcomm::decode_into(seq, buf, bufsize);
+ */
+namespace seqcomm
+{
+
+/*
+ * One sequence of a store, 2 bits per base as in the store's buffer.
+ */
+class packed_view
+{
+public:
+    packed_view() noexcept = default;
+    packed_view(seq_store_t const *store, size_t lid, size_t offset) noexcept
+        : store_(store), data_(store->buf + offset), length_(seq_store_length(*store, lid)), lid_(lid) {}
+
+    uint8_t const *data() const noexcept { return data_; }
+    size_t size() const noexcept { return length_; }
+    size_t bytes() const noexcept { return (length_ + 3) / 4; }
+    bool empty() const noexcept { return !length_; }
+
+    /* 2-bit code (A=0, C=1, G=2, T=3) of base i */
+    unsigned base(size_t i) const noexcept { return (data_[i/4] >> ((i%4)<<1)) & 3; }
+
+    size_t lid() const noexcept { return lid_; }
+    size_t gid() const noexcept { return seq_store_gid(*store_, lid_); }
+    seq_store_t const *store() const noexcept { return store_; }
+
+private:
+    seq_store_t const *store_ = nullptr;
+    uint8_t const *data_ = nullptr;
+    size_t length_ = 0, lid_ = 0;
+};
+
+/*
+ * Random-access iterator over the sequences of a store. Dereferencing yields
+ * a packed_view by value. The buffer offset is carried along, so stepping
+ * costs one length lookup instead of a seq_store_offset call.
+ */
+class seq_iterator
+{
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = packed_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = packed_view;
+
+    seq_iterator() noexcept = default;
+    seq_iterator(seq_store_t const *store, size_t lid) noexcept : store_(store), lid_(lid), offset_(offset_of(store, lid)) {}
+
+    packed_view operator*() const noexcept { return packed_view(store_, lid_, offset_); }
+    packed_view operator[](difference_type n) const noexcept { return *(*this + n); }
+
+    seq_iterator &operator++() noexcept { offset_ += packed_bytes(lid_++); return *this; }
+    seq_iterator &operator--() noexcept { offset_ -= packed_bytes(--lid_); return *this; }
+    seq_iterator operator++(int) noexcept { seq_iterator it = *this; ++*this; return it; }
+    seq_iterator operator--(int) noexcept { seq_iterator it = *this; --*this; return it; }
+
+    seq_iterator &operator+=(difference_type n) noexcept
+    {
+        lid_ += n;
+        offset_ = offset_of(store_, lid_);
+        return *this;
+    }
+
+    seq_iterator &operator-=(difference_type n) noexcept { return *this += -n; }
+
+    friend seq_iterator operator+(seq_iterator it, difference_type n) noexcept { return it += n; }
+    friend seq_iterator operator+(difference_type n, seq_iterator it) noexcept { return it += n; }
+    friend seq_iterator operator-(seq_iterator it, difference_type n) noexcept { return it -= n; }
+    friend difference_type operator-(seq_iterator const &a, seq_iterator const &b) noexcept { return (difference_type)a.lid_ - (difference_type)b.lid_; }
+
+    friend bool operator==(seq_iterator const &a, seq_iterator const &b) noexcept { return a.lid_ == b.lid_; }
+    friend bool operator!=(seq_iterator const &a, seq_iterator const &b) noexcept { return a.lid_ != b.lid_; }
+    friend bool operator<(seq_iterator const &a, seq_iterator const &b) noexcept { return a.lid_ < b.lid_; }
+    friend bool operator>(seq_iterator const &a, seq_iterator const &b) noexcept { return a.lid_ > b.lid_; }
+    friend bool operator<=(seq_iterator const &a, seq_iterator const &b) noexcept { return a.lid_ <= b.lid_; }
+    friend bool operator>=(seq_iterator const &a, seq_iterator const &b) noexcept { return a.lid_ >= b.lid_; }
+
+private:
+    size_t packed_bytes(size_t lid) const noexcept { return (store_->lengths[lid] + 3) / 4; }
+
+    /* the end position has no sample, so it is one past the last sequence */
+    static size_t offset_of(seq_store_t const *store, size_t lid) noexcept
+    {
+        if (lid < store->numseqs)
+            return seq_store_offset(*store, lid);
+
+        return store->numseqs? seq_store_offset(*store, store->numseqs-1) + (store->lengths[store->numseqs-1] + 3) / 4 : 0;
+    }
+
+    seq_store_t const *store_ = nullptr;
+    size_t lid_ = 0, offset_ = 0;
+};
+
+/*
+ * Non-owning view of a seq_store_t.
+ */
+class store_view
+{
+public:
+    using value_type = packed_view;
+    using iterator = seq_iterator;
+    using const_iterator = seq_iterator;
+
+    store_view() noexcept = default;
+    store_view(seq_store_t const *store) noexcept : store_(store) {}
+
+    size_t size() const noexcept { return store_? store_->numseqs : 0; }
+    bool empty() const noexcept { return !size(); }
+    size_t totbases() const noexcept { return store_? store_->totbases : 0; }
+
+    seq_iterator begin() const noexcept { return seq_iterator(store_, 0); }
+    seq_iterator end() const noexcept { return seq_iterator(store_, size()); }
+
+    packed_view operator[](size_t lid) const noexcept { return packed_view(store_, lid, seq_store_offset(*store_, lid)); }
+
+    /* sequence with global id gid, or end(); needs a gid index (see seq_store_index_gids) */
+    seq_iterator find(size_t gid) const noexcept
+    {
+        assert(store_ && store_->gidindex);
+        size_t lid = seq_store_lid(*store_, gid);
+        return lid == SEQ_STORE_NOTFOUND? end() : seq_iterator(store_, lid);
+    }
+
+    seq_store_t const &c() const noexcept { return *store_; }
+
+private:
+    seq_store_t const *store_ = nullptr;
+};
+
+/*
+ * Owning seq_store_t, released with seq_store_free.
+ */
+class store
+{
+public:
+    using value_type = packed_view;
+    using iterator = seq_iterator;
+    using const_iterator = seq_iterator;
+
+    store() noexcept : store_() {}
+    explicit store(seq_store_t const &adopt) noexcept : store_(adopt) {}
+    store(store &&other) noexcept : store_(other.release()) {}
+    store(store const &) = delete;
+    store &operator=(store const &) = delete;
+    ~store() { seq_store_free(&store_); }
+
+    store &operator=(store &&other) noexcept
+    {
+        if (this != &other)
+        {
+            seq_store_free(&store_);
+            store_ = other.release();
+        }
+
+        return *this;
+    }
+
+    /* free the current store and return it as an output argument for the C API */
+    seq_store_t *out() noexcept { seq_store_free(&store_); return &store_; }
+
+    /* give up ownership without freeing */
+    seq_store_t release() noexcept { seq_store_t s = store_; store_ = seq_store_t(); return s; }
+
+    seq_store_t const &c() const noexcept { return store_; }
+    seq_store_t *get() noexcept { return &store_; }
+    store_view view() const noexcept { return store_view(&store_); }
+    operator store_view() const noexcept { return view(); }
+
+    size_t size() const noexcept { return store_.numseqs; }
+    bool empty() const noexcept { return !store_.numseqs; }
+    seq_iterator begin() const noexcept { return view().begin(); }
+    seq_iterator end() const noexcept { return view().end(); }
+    packed_view operator[](size_t lid) const noexcept { return view()[lid]; }
+    seq_iterator find(size_t gid) const noexcept { return view().find(gid); }
+
+private:
+    seq_store_t store_;
+};
+
+/*
+ * Decode bases [start, end) of seq (all of it by default) as ASCII into
+ * dest[0, cap), reverse complemented if revcomp. No terminator is written.
+ * Returns the number of bases written, which is less than end-start if dest
+ * is too short.
+ */
+inline size_t decode_into(packed_view seq, char *dest, size_t cap, size_t start = 0, size_t end = SIZE_MAX, bool revcomp = false) noexcept
+{
+    static const char bases[4] = {'A', 'C', 'G', 'T'};
+
+    end = end < seq.size()? end : seq.size();
+    start = start < end? start : end;
+
+    size_t len = end - start < cap? end - start : cap;
+
+    if (revcomp)
+    {
+        for (size_t i = 0; i < len; ++i)
+            dest[i] = bases[3 ^ seq.base(end-1-i)];
+    }
+    else
+    {
+        for (size_t i = 0; i < len; ++i)
+            dest[i] = bases[seq.base(start+i)];
+    }
+
+    return len;
+}
+
+/*
+ * Decode into any contiguous char container with data() and size(), e.g. a
+ * std::array, a std::vector or a reused std::string.
+ */
+template <class Span>
+inline size_t decode_into(packed_view seq, Span &&dest, size_t start = 0, size_t end = SIZE_MAX, bool revcomp = false) noexcept
+{
+    return decode_into(seq, std::data(dest), std::size(dest), start, end, revcomp);
+}
+
+/*
+ * Copy bases [start, end) of seq, packed and shifted to start at bit 0, into
+ * dest[0, cap) (see seq_store_extract). Returns the number of bytes written,
+ * or 0 if dest is shorter than (end-start+3)/4 bytes.
+ */
+inline size_t extract_into(packed_view seq, uint8_t *dest, size_t cap, size_t start = 0, size_t end = SIZE_MAX, bool revcomp = false) noexcept
+{
+    end = end < seq.size()? end : seq.size();
+    start = start < end? start : end;
+
+    if ((end - start + 3) / 4 > cap)
+        return 0;
+
+    return revcomp? seq_store_extract_revcomp(*seq.store(), seq.lid(), start, end, dest)
+                  : seq_store_extract(*seq.store(), seq.lid(), start, end, dest);
+}
+
+/*
+ * Random-access iterator over the strings of a string_store_t.
+ */
+class name_iterator
+{
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = std::string_view;
+
+    name_iterator() noexcept = default;
+    name_iterator(string_store_t const *store, size_t id) noexcept : store_(store), id_(id) {}
+
+    std::string_view operator*() const noexcept
+    {
+        return std::string_view(sstore_get_string(*store_, id_), sstore_get_string_length(*store_, id_));
+    }
+
+    std::string_view operator[](difference_type n) const noexcept { return *(*this + n); }
+
+    name_iterator &operator++() noexcept { ++id_; return *this; }
+    name_iterator &operator--() noexcept { --id_; return *this; }
+    name_iterator operator++(int) noexcept { name_iterator it = *this; ++id_; return it; }
+    name_iterator operator--(int) noexcept { name_iterator it = *this; --id_; return it; }
+    name_iterator &operator+=(difference_type n) noexcept { id_ += n; return *this; }
+    name_iterator &operator-=(difference_type n) noexcept { id_ -= n; return *this; }
+
+    friend name_iterator operator+(name_iterator it, difference_type n) noexcept { return it += n; }
+    friend name_iterator operator+(difference_type n, name_iterator it) noexcept { return it += n; }
+    friend name_iterator operator-(name_iterator it, difference_type n) noexcept { return it -= n; }
+    friend difference_type operator-(name_iterator const &a, name_iterator const &b) noexcept { return (difference_type)a.id_ - (difference_type)b.id_; }
+
+    friend bool operator==(name_iterator const &a, name_iterator const &b) noexcept { return a.id_ == b.id_; }
+    friend bool operator!=(name_iterator const &a, name_iterator const &b) noexcept { return a.id_ != b.id_; }
+    friend bool operator<(name_iterator const &a, name_iterator const &b) noexcept { return a.id_ < b.id_; }
+    friend bool operator>(name_iterator const &a, name_iterator const &b) noexcept { return a.id_ > b.id_; }
+    friend bool operator<=(name_iterator const &a, name_iterator const &b) noexcept { return a.id_ <= b.id_; }
+    friend bool operator>=(name_iterator const &a, name_iterator const &b) noexcept { return a.id_ >= b.id_; }
+
+    size_t id() const noexcept { return id_; }
+
+private:
+    string_store_t const *store_ = nullptr;
+    size_t id_ = 0;
+};
+
+/*
+ * Non-owning view of a string_store_t. Strings are not NUL-terminated in the
+ * store, so they are only handed out as std::string_view.
+ */
+class names_view
+{
+public:
+    using value_type = std::string_view;
+    using iterator = name_iterator;
+    using const_iterator = name_iterator;
+
+    names_view() noexcept = default;
+    names_view(string_store_t const *store) noexcept : store_(store) {}
+
+    size_t size() const noexcept { return store_? store_->num_strings : 0; }
+    bool empty() const noexcept { return !size(); }
+
+    name_iterator begin() const noexcept { return name_iterator(store_, 0); }
+    name_iterator end() const noexcept { return name_iterator(store_, size()); }
+    std::string_view operator[](size_t id) const noexcept { return begin()[id]; }
+
+    /* id of name s, or SSTORE_NOTFOUND; needs a hash index (see sstore_index_build) */
+    size_t find(std::string_view s) const noexcept
+    {
+        assert(store_ && store_->index);
+        return sstore_lookup(*store_, s.data(), s.size());
+    }
+
+    string_store_t const &c() const noexcept { return *store_; }
+
+private:
+    string_store_t const *store_ = nullptr;
+};
+
+/*
+ * Owning string_store_t, released with string_store_destroy.
+ */
+class string_store
+{
+public:
+    using value_type = std::string_view;
+    using iterator = name_iterator;
+    using const_iterator = name_iterator;
+
+    string_store() noexcept : store_() {}
+    explicit string_store(string_store_t const &adopt) noexcept : store_(adopt) {}
+    string_store(string_store &&other) noexcept : store_(other.release()) {}
+    string_store(string_store const &) = delete;
+    string_store &operator=(string_store const &) = delete;
+    ~string_store() { string_store_destroy(store_); }
+
+    string_store &operator=(string_store &&other) noexcept
+    {
+        if (this != &other)
+        {
+            string_store_destroy(store_);
+            store_ = other.release();
+        }
+
+        return *this;
+    }
+
+    string_store_t *out() noexcept { string_store_destroy(store_); return &store_; }
+    string_store_t release() noexcept { string_store_t s = store_; store_ = string_store_t(); return s; }
+
+    string_store_t const &c() const noexcept { return store_; }
+    string_store_t *get() noexcept { return &store_; }
+    names_view view() const noexcept { return names_view(&store_); }
+    operator names_view() const noexcept { return view(); }
+
+    size_t size() const noexcept { return store_.num_strings; }
+    bool empty() const noexcept { return !store_.num_strings; }
+    name_iterator begin() const noexcept { return view().begin(); }
+    name_iterator end() const noexcept { return view().end(); }
+    std::string_view operator[](size_t id) const noexcept { return view()[id]; }
+    size_t find(std::string_view s) const noexcept { return view().find(s); }
+
+private:
+    string_store_t store_;
+};
+
+/*
+ * Owning fasta_index_t, released with fasta_index_free.
+ */
+class fasta_index
+{
+public:
+    fasta_index() noexcept : faidx_() {}
+    explicit fasta_index(fasta_index_t const &adopt) noexcept : faidx_(adopt) {}
+    fasta_index(fasta_index &&other) noexcept : faidx_(other.release()) {}
+    fasta_index(fasta_index const &) = delete;
+    fasta_index &operator=(fasta_index const &) = delete;
+    ~fasta_index() { fasta_index_free(&faidx_); }
+
+    fasta_index &operator=(fasta_index &&other) noexcept
+    {
+        if (this != &other)
+        {
+            fasta_index_free(&faidx_);
+            faidx_ = other.release();
+        }
+
+        return *this;
+    }
+
+    fasta_index_t *out() noexcept { fasta_index_free(&faidx_); return &faidx_; }
+    fasta_index_t release() noexcept { fasta_index_t f = faidx_; faidx_ = fasta_index_t(); return f; }
+
+    fasta_index_t const &c() const noexcept { return faidx_; }
+    fasta_index_t *get() noexcept { return &faidx_; }
+
+    size_t size() const noexcept { return faidx_.num_records; }
+
+private:
+    fasta_index_t faidx_;
+};
+
+}
+
+#endif
@@ -0,0 +1,398 @@
+#include "sketch.h"
+#include "kmer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define SKETCH_BLOCK 1024 /* sequences per unit of work */
+
+static int uint64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y? -1 : x > y? 1 : 0;
+}
+
+typedef struct
+{
+    uint64_t *hashes;
+    size_t numhashes;
+    uint32_t *counts;
+} sketch_block_t;
+
+/*
+ * Sketch sequences [first, first+count) of store. The canonical k-mers of the
+ * block come from kmer_batch, which reads the packed buffer KMER_LANES
+ * sequences at a time, and are hashed in place.
+ */
+static void sketch_block(const seq_store_t store, sketch_params_t params, size_t first, size_t count, sketch_block_t *block)
+{
+    int k = params.k;
+    uint64_t mask = k == 32? ~0ULL : (1ULL << (2*k)) - 1;
+    uint64_t maxhash = params.mode == SKETCH_FRACMINHASH? mask / (params.scale? params.scale : 1) : mask;
+    size_t numkmers = 0, avail = 0;
+
+    for (size_t i = first; i < first + count; ++i)
+        numkmers += kmer_count(store, i, k);
+
+    uint64_t *kmers = malloc(numkmers * sizeof(uint64_t));
+    kmer_batch(store, first, count, k, kmers);
+
+    for (size_t i = 0; i < numkmers; ++i)
+        kmers[i] = kmer_hash(kmers[i], mask);
+
+    block->hashes = NULL;
+    block->numhashes = 0;
+    block->counts = malloc(count * sizeof(uint32_t));
+
+    uint64_t *h = kmers;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t n = kmer_count(store, first + i, k), m = 0;
+
+        for (size_t j = 0; j < n; ++j)
+            if (h[j] <= maxhash)
+                h[m++] = h[j];
+
+        qsort(h, m, sizeof(uint64_t), uint64_cmp);
+
+        size_t u = 0;
+
+        for (size_t j = 0; j < m; ++j)
+            if (!u || h[j] != h[u-1])
+                h[u++] = h[j];
+
+        if (params.mode == SKETCH_BOTTOMK && u > params.size)
+            u = params.size;
+
+        if (block->numhashes + u > avail)
+        {
+            avail = up_size_t(block->numhashes + u);
+            block->hashes = realloc(block->hashes, avail * sizeof(uint64_t));
+        }
+
+        memcpy(block->hashes + block->numhashes, h, u * sizeof(uint64_t));
+        block->numhashes += u;
+        block->counts[i] = (uint32_t)u;
+        h += n;
+    }
+
+    free(kmers);
+}
+
+/*
+ * Sketch every sequence of store. Blocks of SKETCH_BLOCK sequences are
+ * independent, and are run on all threads when built with OpenMP.
+ */
+int sketch_store(const seq_store_t store, sketch_params_t params, sketch_set_t *set)
+{
+    if (!set || params.k < 1 || params.k > KMER_MAX_K)
+        return -1;
+
+    size_t numblocks = (store.numseqs + SKETCH_BLOCK - 1) / SKETCH_BLOCK;
+    sketch_block_t *blocks = malloc(numblocks * sizeof(sketch_block_t));
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+#endif
+    for (size_t b = 0; b < numblocks; ++b)
+    {
+        size_t first = b * SKETCH_BLOCK;
+        size_t count = store.numseqs - first < SKETCH_BLOCK? store.numseqs - first : SKETCH_BLOCK;
+
+        sketch_block(store, params, first, count, &blocks[b]);
+    }
+
+    *set = (sketch_set_t){0};
+    set->params = params;
+    set->numseqs = store.numseqs;
+    set->lengths = malloc(store.numseqs * sizeof(uint32_t));
+    set->offsets = malloc((store.numseqs + 1) * sizeof(size_t));
+    set->ranges = malloc(store.numranges * sizeof(gid_range_t));
+    set->numranges = store.numranges;
+
+    memcpy(set->lengths, store.lengths, store.numseqs * sizeof(uint32_t));
+    memcpy(set->ranges, store.ranges, store.numranges * sizeof(gid_range_t));
+
+    for (size_t b = 0; b < numblocks; ++b)
+        set->numhashes += blocks[b].numhashes;
+
+    set->hashes = malloc(set->numhashes * sizeof(uint64_t));
+    set->offsets[0] = 0;
+
+    for (size_t b = 0, pos = 0; b < numblocks; ++b)
+    {
+        memcpy(set->hashes + set->offsets[pos], blocks[b].hashes, blocks[b].numhashes * sizeof(uint64_t));
+
+        for (size_t i = 0; pos < store.numseqs && i < SKETCH_BLOCK; ++i, ++pos)
+            set->offsets[pos+1] = set->offsets[pos] + blocks[b].counts[i];
+
+        free(blocks[b].hashes);
+        free(blocks[b].counts);
+    }
+
+    free(blocks);
+    return 0;
+}
+
+/*
+ * Gather the sketch sets of comm into recv_set, ordered by rank, the same
+ * way seq_store_share gathers stores: lengths, sketch sizes, hashes and gid
+ * ranges are exchanged, never sequences.
+ */
+static void allgather_sketches(sketch_set_t const *send_set, sketch_set_t *recv_set, MPI_Comm comm)
+{
+    int myrank, nprocs;
+    mpi_info(comm, &myrank, &nprocs);
+
+    int *recvcnts = malloc(nprocs * sizeof(int));
+    int *displs = malloc(nprocs * sizeof(int));
+    int *seqdispls = malloc(nprocs * sizeof(int));
+    int *counts = malloc(nprocs * 3 * sizeof(int));
+    int mycounts[3] = {(int)send_set->numseqs, (int)send_set->numhashes, (int)send_set->numranges};
+
+    MPI_Allgather(mycounts, 3, MPI_INT, counts, 3, MPI_INT, comm);
+
+    *recv_set = (sketch_set_t){0};
+    recv_set->params = send_set->params;
+
+    /*
+     * Lengths and sketch sizes.
+     */
+    for (int i = 0; i < nprocs; ++i)
+        recvcnts[i] = counts[3*i];
+
+    partial_sum(seqdispls, recvcnts, nprocs);
+    recv_set->numseqs = seqdispls[nprocs-1] + recvcnts[nprocs-1];
+    recv_set->lengths = malloc(recv_set->numseqs * sizeof(uint32_t));
+
+    uint32_t *sizes = malloc(send_set->numseqs * sizeof(uint32_t));
+    uint32_t *allsizes = malloc(recv_set->numseqs * sizeof(uint32_t));
+
+    for (size_t i = 0; i < send_set->numseqs; ++i)
+        sizes[i] = (uint32_t)(send_set->offsets[i+1] - send_set->offsets[i]);
+
+    MPI_Allgatherv(send_set->lengths, mycounts[0], MPI_UINT32_T, recv_set->lengths, recvcnts, seqdispls, MPI_UINT32_T, comm);
+    MPI_Allgatherv(sizes, mycounts[0], MPI_UINT32_T, allsizes, recvcnts, seqdispls, MPI_UINT32_T, comm);
+
+    recv_set->offsets = malloc((recv_set->numseqs + 1) * sizeof(size_t));
+    recv_set->offsets[0] = 0;
+
+    for (size_t i = 0; i < recv_set->numseqs; ++i)
+        recv_set->offsets[i+1] = recv_set->offsets[i] + allsizes[i];
+
+    free(sizes);
+    free(allsizes);
+
+    /*
+     * Hashes.
+     */
+    for (int i = 0; i < nprocs; ++i)
+        recvcnts[i] = counts[3*i+1];
+
+    partial_sum(displs, recvcnts, nprocs);
+    recv_set->numhashes = recv_set->offsets[recv_set->numseqs];
+    recv_set->hashes = malloc(recv_set->numhashes * sizeof(uint64_t));
+
+    MPI_Allgatherv(send_set->hashes, mycounts[1], MPI_UINT64_T, recv_set->hashes, recvcnts, displs, MPI_UINT64_T, comm);
+
+    /*
+     * Global id ranges, shifted by the local id displacement of their sender.
+     */
+    MPI_Datatype gid_range_mpi_t;
+    MPI_Type_contiguous(2, MPI_SIZE_T, &gid_range_mpi_t);
+    MPI_Type_commit(&gid_range_mpi_t);
+
+    for (int i = 0; i < nprocs; ++i)
+        recvcnts[i] = counts[3*i+2];
+
+    partial_sum(displs, recvcnts, nprocs);
+    recv_set->numranges = displs[nprocs-1] + recvcnts[nprocs-1];
+    recv_set->ranges = malloc(recv_set->numranges * sizeof(gid_range_t));
+
+    MPI_Allgatherv(send_set->ranges, mycounts[2], gid_range_mpi_t, recv_set->ranges, recvcnts, displs, gid_range_mpi_t, comm);
+    MPI_Type_free(&gid_range_mpi_t);
+
+    for (int i = 0; i < nprocs; ++i)
+        for (int j = displs[i]; j < displs[i] + recvcnts[i]; ++j)
+            recv_set->ranges[j].lid += seqdispls[i];
+
+    free(recvcnts);
+    free(displs);
+    free(seqdispls);
+    free(counts);
+}
+
+int sketch_share(sketch_set_t const *set, sketch_set_t *row_set, sketch_set_t *col_set, commgrid_t const *grid)
+{
+    if (!set || !row_set || !col_set || !grid)
+        return -1;
+
+    allgather_sketches(set, row_set, grid->row_world);
+    allgather_sketches(set, col_set, grid->col_world);
+
+    return 0;
+}
+
+/*
+ * Jaccard similarity estimate of sketch i of a and sketch j of b: the
+ * fraction of the smallest (bottom-k) or all (FracMinHash) hashes of the
+ * union that are in both.
+ */
+double sketch_jaccard(sketch_set_t const *a, size_t i, sketch_set_t const *b, size_t j)
+{
+    uint64_t const *x = a->hashes + a->offsets[i], *xend = a->hashes + a->offsets[i+1];
+    uint64_t const *y = b->hashes + b->offsets[j], *yend = b->hashes + b->offsets[j+1];
+    size_t limit = a->params.mode == SKETCH_BOTTOMK? a->params.size : SIZE_MAX;
+    size_t unions = 0, shared = 0;
+
+    while (unions < limit && (x < xend || y < yend))
+    {
+        if (y == yend || (x < xend && *x < *y)) x++;
+        else if (x == xend || *y < *x) y++;
+        else
+        {
+            shared++;
+            x++;
+            y++;
+        }
+
+        unions++;
+    }
+
+    return unions? (double)shared / unions : 0.0;
+}
+
+typedef struct { uint64_t hash; size_t j; } posting_t;
+
+static int posting_cmp(const void *a, const void *b)
+{
+    const posting_t *x = a, *y = b;
+
+    if (x->hash != y->hash) return x->hash < y->hash? -1 : 1;
+    return x->j < y->j? -1 : x->j > y->j? 1 : 0;
+}
+
+/*
+ * Owned pairs (see pair_owned) of row_set x col_set whose estimated Jaccard
+ * similarity is at least minjaccard. Only pairs sharing a hash are scored,
+ * found through an inverted index of the column sketches. Returns the
+ * number of pairs, written to the malloc'd *pairs with the product of the
+ * sequence lengths as work; only these need their sequences fetched.
+ */
+size_t sketch_candidates(sketch_set_t const *row_set, sketch_set_t const *col_set, double minjaccard, pair_task_t **pairs)
+{
+    size_t numpostings = col_set->numhashes, numpairs = 0, avail = 0;
+    posting_t *postings = malloc(numpostings * sizeof(posting_t));
+
+    for (size_t j = 0; j < col_set->numseqs; ++j)
+        for (size_t h = col_set->offsets[j]; h < col_set->offsets[j+1]; ++h)
+            postings[h] = (posting_t){col_set->hashes[h], j};
+
+    qsort(postings, numpostings, sizeof(posting_t), posting_cmp);
+
+    size_t *colgids = malloc(col_set->numseqs * sizeof(size_t));
+    uint8_t *seen = calloc(col_set->numseqs, 1);
+    size_t *touched = malloc(col_set->numseqs * sizeof(size_t));
+
+    for (size_t j = 0; j < col_set->numseqs; ++j)
+        colgids[j] = sketch_gid(col_set, j);
+
+    *pairs = NULL;
+
+    for (size_t i = 0; i < row_set->numseqs; ++i)
+    {
+        size_t rowgid = sketch_gid(row_set, i), numtouched = 0;
+
+        for (size_t h = row_set->offsets[i]; h < row_set->offsets[i+1]; ++h)
+        {
+            size_t lo = 0, hi = numpostings;
+            uint64_t hash = row_set->hashes[h];
+
+            /* first posting with postings[lo].hash >= hash */
+            while (lo < hi)
+            {
+                size_t mid = (lo + hi) / 2;
+
+                if (postings[mid].hash < hash) lo = mid + 1;
+                else hi = mid;
+            }
+
+            for (; lo < numpostings && postings[lo].hash == hash; ++lo)
+            {
+                size_t j = postings[lo].j;
+
+                if (!seen[j] && pair_owned(rowgid, colgids[j]))
+                {
+                    seen[j] = 1;
+                    touched[numtouched++] = j;
+                }
+            }
+        }
+
+        for (size_t t = 0; t < numtouched; ++t)
+        {
+            size_t j = touched[t];
+
+            seen[j] = 0;
+
+            if (sketch_jaccard(row_set, i, col_set, j) < minjaccard)
+                continue;
+
+            if (numpairs == avail)
+            {
+                avail = avail? 2*avail : 1024;
+                *pairs = realloc(*pairs, avail * sizeof(pair_task_t));
+            }
+
+            (*pairs)[numpairs++] = (pair_task_t){i, j, (uint64_t)row_set->lengths[i] * col_set->lengths[j]};
+        }
+    }
+
+    free(postings);
+    free(colgids);
+    free(seen);
+    free(touched);
+
+    *pairs = realloc(*pairs, numpairs * sizeof(pair_task_t));
+    return numpairs;
+}
+
+/*
+ * Compare the bytes a process sends to share its sketches with those it
+ * sends to share its store (both go to every row and column peer).
+ */
+void sketch_report(sketch_set_t const *set, const seq_store_t store, size_t numpairs, commgrid_t const *grid, FILE *f)
+{
+    size_t sums[4], gsums[4];
+
+    sums[0] = set->numhashes * sizeof(uint64_t) + set->numseqs * 2 * sizeof(uint32_t) + set->numranges * sizeof(gid_range_t);
+    sums[1] = store.numbytes + store.numseqs * sizeof(uint32_t) + store.numranges * sizeof(gid_range_t);
+    sums[2] = set->numhashes;
+    sums[3] = numpairs;
+
+    MPI_Reduce(sums, gsums, 4, MPI_SIZE_T, MPI_SUM, 0, grid->grid_world);
+
+    if (!grid->gridrank)
+    {
+        fprintf(f, "sketch_report:\n");
+        fprintf(f, "\t%s sketches, k=%d: %lu hashes\n", set->params.mode == SKETCH_BOTTOMK? "bottom-k" : "FracMinHash", set->params.k, gsums[2]);
+        fprintf(f, "\tshared %lu bytes instead of %lu (%.4f)\n", gsums[0], gsums[1], gsums[1]? (double)gsums[0] / gsums[1] : 0.0);
+        fprintf(f, "\t%lu candidate pairs\n", gsums[3]);
+        fflush(f);
+    }
+}
+
+int sketch_free(sketch_set_t *set)
+{
+    if (!set) return -1;
+
+    free(set->lengths);
+    free(set->offsets);
+    free(set->hashes);
+    free(set->ranges);
+    *set = (sketch_set_t){0};
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef SKETCH_H_
+#define SKETCH_H_
+
+#include "seq_store.h"
+#include "pair_tasks.h"
+#include "mpiutil.h"
+
+/*
+ * MinHash sketches of the canonical k-mers of every sequence of a store,
+ * for candidate discovery without moving whole sequences. A bottom-k sketch
+ * holds the size smallest distinct k-mer hashes of a sequence, a FracMinHash
+ * sketch all distinct hashes below 4^k/scale. Hashes are sorted ascending.
+ */
+#define SKETCH_BOTTOMK 0
+#define SKETCH_FRACMINHASH 1
+
+typedef struct
+{
+    int mode;     /* SKETCH_* */
+    int k;        /* k-mer length, <= KMER_MAX_K */
+    size_t size;  /* bottom-k sketch size */
+    size_t scale; /* FracMinHash keeps about one in scale k-mers */
+} sketch_params_t;
+
+#define SKETCH_PARAMS_INIT (sketch_params_t){SKETCH_BOTTOMK, 21, 128, 1000}
+
+typedef struct
+{
+    sketch_params_t params;
+    size_t numseqs;
+    uint32_t *lengths;   /* sequence lengths */
+    size_t *offsets;     /* sketch i is hashes[offsets[i], offsets[i+1]) */
+    uint64_t *hashes;
+    size_t numhashes;
+    gid_range_t *ranges; /* global ids, as in seq_store_t */
+    size_t numranges;
+} sketch_set_t;
+
+static inline size_t sketch_gid(sketch_set_t const *set, size_t i)
+{
+    size_t lo = 0, hi = set->numranges;
+
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if (set->ranges[mid].lid <= i) lo = mid;
+        else hi = mid;
+    }
+
+    return set->ranges[lo].gid + (i - set->ranges[lo].lid);
+}
+
+int sketch_store(const seq_store_t store, sketch_params_t params, sketch_set_t *set);
+int sketch_share(sketch_set_t const *set, sketch_set_t *row_set, sketch_set_t *col_set, commgrid_t const *grid);
+double sketch_jaccard(sketch_set_t const *a, size_t i, sketch_set_t const *b, size_t j);
+size_t sketch_candidates(sketch_set_t const *row_set, sketch_set_t const *col_set, double minjaccard, pair_task_t **pairs);
+void sketch_report(sketch_set_t const *set, const seq_store_t store, size_t numpairs, commgrid_t const *grid, FILE *f);
+int sketch_free(sketch_set_t *set);
+
+#endif
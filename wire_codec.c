@@ -0,0 +1,273 @@
+#include "wire_codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#define LZ_HASH_BITS 16
+#define LZ_MINMATCH 4
+#define LZ_WINDOW ((1 << 24) - 1)
+#define LZ_MAXSTEP 8
+
+/*
+ * The probe compresses one contiguous prefix, so that it sees repeats that
+ * are far apart, as in the whole segment.
+ */
+#define WIRE_PROBE_BYTES (1024*1024)
+
+static inline uint32_t read32(uint8_t const *p)
+{
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return x;
+}
+
+static inline uint32_t lz_hash(uint32_t x)
+{
+    return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_length(uint8_t *op, size_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/*
+ * A sequence is a token (literal length in the high nibble, match length
+ * minus LZ_MINMATCH in the low one, 15 meaning more length bytes follow),
+ * the literals, a 3-byte offset and the match length bytes. The last
+ * sequence has literals only.
+ */
+static uint8_t *lz_sequence(uint8_t *op, uint8_t const *lit, size_t litlen, size_t offset, size_t mlen)
+{
+    uint8_t *token = op++;
+    size_t mcode = mlen? mlen - LZ_MINMATCH : 0;
+
+    *token = (uint8_t)(((litlen < 15? litlen : 15) << 4) | (mcode < 15? mcode : 15));
+
+    if (litlen >= 15)
+        op = lz_length(op, litlen - 15);
+
+    memcpy(op, lit, litlen);
+    op += litlen;
+
+    if (!mlen)
+        return op;
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    *op++ = (uint8_t)(offset >> 16);
+
+    if (mcode >= 15)
+        op = lz_length(op, mcode - 15);
+
+    return op;
+}
+
+static size_t lz_compress(uint8_t const *src, size_t n, uint8_t *dst)
+{
+    uint32_t *table = calloc(1 << LZ_HASH_BITS, sizeof(uint32_t)); /* position+1 */
+    uint8_t *op = dst;
+    size_t ip = 0, anchor = 0;
+
+    while (ip + LZ_MINMATCH <= n)
+    {
+        uint32_t h = lz_hash(read32(src + ip));
+        size_t ref = table[h];
+
+        table[h] = (uint32_t)(ip + 1);
+
+        if (ref-- && ip - ref <= LZ_WINDOW && read32(src + ref) == read32(src + ip))
+        {
+            size_t mlen = LZ_MINMATCH;
+
+            while (ip + mlen < n && src[ref + mlen] == src[ip + mlen])
+                mlen++;
+
+            /* matches found after a skip may start earlier */
+            while (ip > anchor && ref > 0 && src[ip-1] == src[ref-1])
+            {
+                ip--;
+                ref--;
+                mlen++;
+            }
+
+            op = lz_sequence(op, src + anchor, ip - anchor, ip - ref, mlen);
+            ip += mlen;
+            anchor = ip;
+        }
+        else
+        {
+            /* move faster through data that does not match */
+            size_t step = 1 + ((ip - anchor) >> 6);
+            ip += step < LZ_MAXSTEP? step : LZ_MAXSTEP;
+        }
+    }
+
+    op = lz_sequence(op, src + anchor, n - anchor, 0, 0);
+
+    free(table);
+    return op - dst;
+}
+
+static int lz_decompress(uint8_t const *src, size_t n, uint8_t *dst, size_t dstlen)
+{
+    uint8_t const *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + dstlen;
+
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+        size_t len = token >> 4;
+
+        if (len == 15)
+        {
+            unsigned b;
+            do { if (ip == iend) return -1; b = *ip++; len += b; } while (b == 255);
+        }
+
+        if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+            return -1;
+
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 3)
+            return -1;
+
+        size_t offset = ip[0] | ((size_t)ip[1] << 8) | ((size_t)ip[2] << 16);
+        ip += 3;
+
+        len = (token & 15) + LZ_MINMATCH;
+
+        if ((token & 15) == 15)
+        {
+            unsigned b;
+            do { if (ip == iend) return -1; b = *ip++; len += b; } while (b == 255);
+        }
+
+        if (!offset || offset > (size_t)(op - dst) || len > (size_t)(oend - op))
+            return -1;
+
+        uint8_t const *match = op - offset;
+
+        if (offset >= 8)
+        {
+            for (; len >= 8; len -= 8, op += 8, match += 8)
+                memcpy(op, match, 8);
+        }
+
+        while (len--)
+            *op++ = *match++;
+    }
+
+    return op == oend? 0 : -1;
+}
+
+size_t wire_bound(size_t n)
+{
+#ifdef USE_ZSTD
+    size_t zbound = ZSTD_compressBound(n) + 1;
+    if (zbound > n + n/255 + 16) return zbound;
+#endif
+    return n + n/255 + 16;
+}
+
+/*
+ * Compress n bytes of src into dst, which must hold wire_bound(n) bytes.
+ * Data that does not compress is stored as is. Returns the blob size.
+ */
+size_t wire_compress(uint8_t const *src, size_t n, uint8_t *dst)
+{
+    size_t size;
+
+#ifdef USE_ZSTD
+    size = ZSTD_compress(dst + 1, wire_bound(n) - 1, src, n, 1);
+    dst[0] = WIRE_ZSTD;
+    if (ZSTD_isError(size)) size = n;
+#else
+    size = lz_compress(src, n, dst + 1);
+    dst[0] = WIRE_LZ;
+#endif
+
+    if (size >= n)
+    {
+        dst[0] = WIRE_RAW;
+        memcpy(dst + 1, src, n);
+        size = n;
+    }
+
+    return size + 1;
+}
+
+/*
+ * Decode a blob of n bytes into exactly dstlen bytes of dst. Returns -1 if
+ * the blob is corrupt or of a codec this build does not have.
+ */
+int wire_decompress(uint8_t const *src, size_t n, uint8_t *dst, size_t dstlen)
+{
+    if (n < 1)
+        return dstlen? -1 : 0;
+
+    switch (src[0])
+    {
+        case WIRE_RAW:
+            if (n - 1 != dstlen) return -1;
+            memcpy(dst, src + 1, dstlen);
+            return 0;
+
+        case WIRE_LZ:
+            return lz_decompress(src + 1, n - 1, dst, dstlen);
+
+#ifdef USE_ZSTD
+        case WIRE_ZSTD:
+            return ZSTD_decompress(dst, dstlen, src + 1, n - 1) == dstlen? 0 : -1;
+#endif
+
+        default:
+            return -1;
+    }
+}
+
+void wire_probe(uint8_t const *src, size_t n, double *ratio, double *ctime, double *dtime)
+{
+    size_t sample = n < WIRE_PROBE_BYTES? n : WIRE_PROBE_BYTES;
+
+    if (!sample)
+    {
+        *ratio = 1.0;
+        *ctime = *dtime = 0.0;
+        return;
+    }
+
+    uint8_t *blob = malloc(wire_bound(sample));
+    uint8_t *back = malloc(sample);
+
+    double t = MPI_Wtime();
+    size_t size = wire_compress(src, sample, blob);
+    *ctime = (MPI_Wtime() - t) / sample;
+
+    t = MPI_Wtime();
+    wire_decompress(blob, size, back, sample);
+    *dtime = (MPI_Wtime() - t) / sample;
+
+    *ratio = (double)size / sample;
+
+    free(blob);
+    free(back);
+}
@@ -0,0 +1,32 @@
+#ifndef WIRE_CODEC_H_
+#define WIRE_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Codec for packed sequence buffers sent over the network. A compressed
+ * blob starts with one byte naming how it was encoded, so receivers need no
+ * other information than the blob and the decoded length.
+ *
+ * The default codec is an LZ77 byte codec in the style of the LZ4 block
+ * format, with 4-byte minimum matches and a 16MB window (3-byte offsets), so
+ * that it picks up the duplicated and repeated sequences that 2-bit packing
+ * leaves in place anywhere in a process's segment.
+ * Building with -DUSE_ZSTD (and -lzstd) uses zstd at level 1 instead.
+ */
+#define WIRE_RAW 0
+#define WIRE_LZ 1
+#define WIRE_ZSTD 2
+
+size_t wire_bound(size_t n);
+size_t wire_compress(uint8_t const *src, size_t n, uint8_t *dst);
+int wire_decompress(uint8_t const *src, size_t n, uint8_t *dst, size_t dstlen);
+
+/*
+ * Estimate the compression ratio of src and the compression and
+ * decompression cost in seconds per input byte, from a prefix of src.
+ */
+void wire_probe(uint8_t const *src, size_t n, double *ratio, double *ctime, double *dtime);
+
+#endif